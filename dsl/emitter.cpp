@@ -1,13 +1,55 @@
 #include "emitter.h"
+#include "builtins.h"
 #include "matchers.h"
+#include "sema.h"
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <unistd.h>
 
 using namespace lang;
 
 thread_local SymbolTableMap Emitter::symbolTable_;
+thread_local TargetInfo Emitter::target_;
+thread_local std::map<std::string, std::string> Emitter::elementTypes_;
+thread_local std::map<std::string, int64_t> Emitter::elementSizes_;
+thread_local std::map<std::string, std::string> Emitter::storageFormats_;
+thread_local std::vector<SymbolicSize> Emitter::transposed_;
+
+TargetInfo getHostTargetInfo() {
+  TargetInfo target;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+  auto query = [](int name, int64_t &size) {
+    long res = sysconf(name);
+    if (res > 0)
+      size = res;
+  };
+  query(_SC_LEVEL1_DCACHE_SIZE, target.l1CacheSize);
+  query(_SC_LEVEL2_CACHE_SIZE, target.l2CacheSize);
+  query(_SC_LEVEL3_CACHE_SIZE, target.l3CacheSize);
+#endif
+  return target;
+}
+
+void SymbolTableMap::reset() { *this = SymbolTableMap(); }
+
+std::string SymbolTableMap::getNextVariable(const SymbolicSize &size) {
+  std::string res = acquireBuffer(size, "");
+  if (res.empty()) {
+    res = getNextView();
+    buffers_[res] = size;
+  }
+  lastEmittedVar_ = res;
+  return res;
+}
 
-std::string SymbolTableMap::getNextVariable() {
-  std::string res = "tmp" + std::to_string(nextId_++);
+std::string SymbolTableMap::getNextView() {
+  std::string res;
+  do {
+    res = "tmp" + std::to_string(nextId_++);
+  } while (reserved_.count(res));
+  reserved_.insert(res);
   lastEmittedVar_ = res;
   return res;
 }
@@ -16,6 +58,89 @@ std::string SymbolTableMap::getLastEmittedVariable() const {
   return lastEmittedVar_;
 }
 
+void SymbolTableMap::reserve(const std::string &name) {
+  reserved_.insert(name);
+}
+
+void SymbolTableMap::registerTensor(const Tensor &tensor) {
+  symbolTable_[tensor.name_] = tensor;
+}
+
+bool SymbolTableMap::hasTensor(const std::string &name) const {
+  return symbolTable_.count(name);
+}
+
+void SymbolTableMap::registerView(const std::string &view,
+                                  const std::string &source) {
+  views_[view] = getStorage(source);
+}
+
+std::string SymbolTableMap::getStorage(const std::string &name) const {
+  auto it = views_.find(name);
+  if (it == views_.end())
+    return name;
+  return it->second;
+}
+
+bool SymbolTableMap::lookupTensor(const std::string &name,
+                                  Tensor &tensor) const {
+  auto it = symbolTable_.find(name);
+  if (it == symbolTable_.end())
+    return false;
+  tensor = it->second;
+  return true;
+}
+
+std::string SymbolTableMap::acquireBuffer(const SymbolicSize &size,
+                                          const std::string &name) {
+  for (auto it = freeBuffers_.begin(); it != freeBuffers_.end(); it++) {
+    if (buffers_[*it] != size)
+      continue;
+    auto res = *it;
+    freeBuffers_.erase(it);
+    dead_.erase(res);
+    return res;
+  }
+  if (!name.empty())
+    buffers_[name] = size;
+  return name;
+}
+
+void SymbolTableMap::releaseBuffer(const std::string &name) {
+  dead_.insert(name);
+  // the storage is free only when the buffer and all its views are dead.
+  auto storage = getStorage(name);
+  if (!buffers_.count(storage) || !dead_.count(storage))
+    return;
+  for (const auto &view : views_)
+    if (view.second == storage && !dead_.count(view.first))
+      return;
+  if (std::find(freeBuffers_.begin(), freeBuffers_.end(), storage) !=
+      freeBuffers_.end())
+    return;
+  freeBuffers_.push_back(storage);
+}
+
+std::string SymbolTableMap::getPeakFootprint() const {
+  if (buffers_.empty())
+    return "0 elements";
+  std::string res;
+  for (const auto &buffer : buffers_) {
+    if (!res.empty())
+      res += " + ";
+    if (buffer.second.empty())
+      res += "1";
+    for (size_t i = 0; i < buffer.second.size(); i++) {
+      if (i != 0)
+        res += "*";
+      res += buffer.second[i];
+    }
+  }
+  res += " elements in " + std::to_string(buffers_.size()) +
+         ((buffers_.size() == 1) ? " buffer" : " buffers");
+  return res;
+}
+
 // Resursively maps the function `fn` to `tree` and all of its
 // descendants in preorder - teckyl style.
 static void applyRecursive(const TreeRef &tree,
@@ -25,6 +150,114 @@ static void applyRecursive(const TreeRef &tree,
     applyRecursive(e, fn);
 }
 
+// Map each index used in `c` to the base indices it ranges over. Indices
+// are resolved through the dimensions of the tensors already in the symbol
+// table and through the let bindings of the where clauses. Indices that
+// cannot be resolved are not in the map and stand for themselves.
+static std::map<std::string, SymbolicSize>
+resolveIndices(Comprehension c, const SymbolTableMap &symbolTable) {
+  std::map<std::string, SymbolicSize> res;
+  auto resolveAccess = [&](const std::string &name,
+                           const std::vector<std::string> &indexes) {
+    Tensor tensor;
+    if (!symbolTable.lookupTensor(name, tensor) ||
+        tensor.dims_.size() != indexes.size())
+      return;
+    for (size_t i = 0; i < indexes.size(); i++)
+      res.insert({indexes[i], tensor.dims_[i]});
+  };
+
+  applyRecursive(c.rhs(), [&](const TreeRef &t) {
+    if (t->kind() != TK_APPLY)
+      return;
+    std::vector<std::string> indexes;
+    for (const auto &arg : Apply(t).arguments()) {
+      if (arg->kind() != TK_IDENT)
+        return;
+      indexes.push_back(Ident(arg).name());
+    }
+    resolveAccess(Apply(t).name().name(), indexes);
+  });
+  std::vector<std::string> lhsIndexes;
+  for (const auto &index : c.indices())
+    lhsIndexes.push_back(index.name());
+  resolveAccess(c.ident().name(), lhsIndexes);
+
+  for (const auto &where : c.whereClauses()) {
+    if (where->kind() != TK_LET)
+      continue;
+    auto let = Let(where);
+    if (res.count(let.name().name()))
+      continue;
+    SymbolicSize size;
+    applyRecursive(let.rhs(), [&](const TreeRef &t) {
+      if (t->kind() != TK_IDENT)
+        return;
+      auto it = res.find(Ident(t).name());
+      if (it == res.end())
+        size.push_back(Ident(t).name());
+      else
+        size.insert(size.end(), it->second.begin(), it->second.end());
+    });
+    res.insert({let.name().name(), size});
+  }
+  return res;
+}
+
+// Number of elements spanned by `indexes`.
+static SymbolicSize
+getSize(const std::vector<std::string> &indexes,
+        const std::map<std::string, SymbolicSize> &resolved) {
+  SymbolicSize res;
+  for (const auto &index : indexes) {
+    auto it = resolved.find(index);
+    if (it == resolved.end())
+      res.push_back(index);
+    else
+      res.insert(res.end(), it->second.begin(), it->second.end());
+  }
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+// Return a copy of `t` where the tensors in `names` are renamed.
+static TreeRef renameTensors(const TreeRef &t,
+                             const std::map<std::string, std::string> &names) {
+  auto rename = [&](const TreeRef &ident) -> TreeRef {
+    auto it = names.find(Ident(ident).name());
+    if (it == names.end())
+      return ident;
+    return Ident::create(ident->range(), it->second);
+  };
+  switch (t->kind()) {
+  case TK_COMPREHENSION: {
+    auto c = Comprehension(t);
+    return Comprehension::create(
+        c.range(), rename(c.ident()), c.indices(), c.assignment(),
+        renameTensors(c.rhs(), names), c.whereClauses(), c.equivalent(),
+        c.reductionVariables());
+  }
+  case TK_APPLY:
+    return Apply::create(t->range(), rename(t->tree(0)),
+                         renameTensors(t->tree(1), names));
+  default:
+    return t->map([&](TreeRef c) { return renameTensors(c, names); });
+  }
+}
+
+// Collect the tensors accessed by `c`, the output first.
+static std::vector<std::string> getTensors(Comprehension c) {
+  std::vector<std::string> res = {c.ident().name()};
+  applyRecursive(c.rhs(), [&](const TreeRef &t) {
+    if (t->kind() != TK_APPLY)
+      return;
+    auto name = Apply(t).name().name();
+    if (!builtin_functions.count(name))
+      res.push_back(name);
+  });
+  return res;
+}
+
 static bool isTN(Comprehension c, MatMulInfo &mmi) {
   using namespace matchers;
   auto ctx = m_ctx();
@@ -301,13 +534,183 @@ static bool isT(Comprehension c, MatVecInfo &mvi) {
   return true;
 }
 
+// helper.
+bool find(const std::string &target,
+          const std::vector<std::string> &arrayToInspect) {
+  auto it = std::find(arrayToInspect.begin(), arrayToInspect.end(), target);
+  if (it == arrayToInspect.end())
+    return false;
+  return true;
+}
+
+// helper.
+bool find(const std::vector<std::string> &targets,
+          const std::vector<std::string> &arrayToInspect) {
+  for (const auto &elem : targets)
+    if (!find(elem, arrayToInspect))
+      return false;
+  return true;
+}
+
+// Collect the extents given by range constraints (i.e., where j in 0:1000).
+// Return false if "c" has other where clauses.
+static bool getExtents(const Comprehension &c,
+                       std::map<std::string, int64_t> &extents) {
+  for (const auto &where : c.whereClauses()) {
+    if (where->kind() != TK_RANGE_CONSTRAINT)
+      return false;
+    auto range = RangeConstraint(where);
+    if (range.start()->kind() == TK_CONST && range.end()->kind() == TK_CONST)
+      extents[range.ident().name()] =
+          Const(range.end()).value() - Const(range.start()).value();
+  }
+  return true;
+}
+
+// Return the access `t` as a tensor. Fail if `t` is not an access
+// or if it is not indexed by plain indices.
+static bool getAccess(const TreeRef &t, Tensor &tensor) {
+  if (t->kind() != TK_APPLY)
+    return false;
+  tensor.name_ = Apply(t).name().name();
+  tensor.indices_.clear();
+  for (const auto &arg : Apply(t).arguments()) {
+    if (arg->kind() != TK_IDENT)
+      return false;
+    if (find(Ident(arg).name(), tensor.indices_))
+      return false;
+    tensor.indices_.push_back(Ident(arg).name());
+  }
+  return true;
+}
+
+static void recursivelyEmitRhs(const TreeRef &t, llvm::raw_ostream &os,
+                               const TreeRef &acc = nullptr);
+
+// Return the scalar "t" (an identifier or a constant) as a string.
+static bool getScalar(const TreeRef &t, std::string &value) {
+  if (t->kind() != TK_IDENT && t->kind() != TK_CONST)
+    return false;
+  value.clear();
+  llvm::raw_string_ostream vos(value);
+  recursivelyEmitRhs(t, vos);
+  vos.flush();
+  return true;
+}
+
+// Match A(...) * B(...) or alpha * (A(...) * B(...)).
+static bool matchProduct(const TreeRef &rhs, Tensor &a, Tensor &b,
+                         std::string &alpha) {
+  if (rhs->kind() != '*')
+    return false;
+  alpha = "1";
+  auto product = rhs;
+  if (rhs->tree(1)->kind() == '*' && getScalar(rhs->tree(0), alpha))
+    product = rhs->tree(1);
+  return getAccess(product->tree(0), a) && getAccess(product->tree(1), b);
+}
+
+static size_t getPosition(const std::vector<std::string> &v,
+                          const std::string &s) {
+  return std::distance(v.begin(), std::find(v.begin(), v.end(), s));
+}
+
+// Return true if `indices` is `first` followed by `second`.
+static bool isConcat(const std::vector<std::string> &indices,
+                     const std::vector<std::string> &first,
+                     const std::vector<std::string> &second) {
+  auto concat = first;
+  concat.insert(concat.end(), second.begin(), second.end());
+  return indices == concat;
+}
+
+static std::string join(const std::vector<std::string> &indices) {
+  std::string res;
+  for (size_t i = 0; i < indices.size(); i++)
+    res += (i == 0) ? indices[i] : "*" + indices[i];
+  return res;
+}
+
+// check if we are dealing with a matmul where M, N and K are groups
+// of indices already contiguous and in the same order in all the operands
+// (i.e., C(m, n, p) += A(m, k) * B(k, n, p)). The matmul can then run on
+// the tensors directly without any reshape.
+bool Emitter::matchGroupedMatMul(MatMulInfo &mmi) {
+  // range constraints only carry extents.
+  for (const auto &clause : comprehension_.whereClauses())
+    if (clause->kind() != TK_RANGE_CONSTRAINT)
+      return false;
+
+  Tensor a, b;
+  std::string alpha;
+  if (!matchProduct(comprehension_.rhs(), a, b, alpha))
+    return false;
+  auto C = comprehension_.ident().name();
+  if ((C == a.name_) || (C == b.name_))
+    return false;
+  std::vector<std::string> indexC;
+  for (const auto &index : comprehension_.indices()) {
+    if (find(index.name(), indexC))
+      return false;
+    indexC.push_back(index.name());
+  }
+
+  // M indices are in A and C, N in B and C and K in A and B.
+  std::vector<std::string> m, n, k;
+  for (const auto &index : indexC) {
+    bool inA = find(index, a.indices_);
+    bool inB = find(index, b.indices_);
+    if (inA == inB)
+      return false;
+    if (inA)
+      m.push_back(index);
+    else
+      n.push_back(index);
+  }
+  for (const auto &index : a.indices_)
+    if (!find(index, indexC))
+      k.push_back(index);
+  if (m.empty() || n.empty() || k.empty())
+    return false;
+  if (!find(k, b.indices_) || b.indices_.size() != n.size() + k.size())
+    return false;
+
+  if (!isConcat(indexC, m, n))
+    return false;
+  if (isConcat(a.indices_, m, k))
+    mmi.transa = Trans::N;
+  else if (isConcat(a.indices_, k, m))
+    mmi.transa = Trans::T;
+  else
+    return false;
+  if (isConcat(b.indices_, k, n))
+    mmi.transb = Trans::N;
+  else if (isConcat(b.indices_, n, k))
+    mmi.transb = Trans::T;
+  else
+    return false;
+
+  mmi.A = a.name_;
+  mmi.B = b.name_;
+  mmi.C = C;
+  mmi.m = join(m);
+  mmi.n = join(n);
+  mmi.k = join(k);
+  mmi.alpha = alpha;
+  mmi.beta = "1";
+  mmi.dimensionsForM = m.size();
+  mmi.dimensionsForN = n.size();
+  mmi.dimensionsForK = k.size();
+  return true;
+}
+
 // check if we are dealing with matmul.
 bool Emitter::matchMatMul(MatMulInfo &mmi) {
   if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
     return false;
 
   if (comprehension_.indices().size() != 2)
-    return false;
+    return matchGroupedMatMul(mmi);
 
   bool matchedFlag = false;
   bool aTransFlag = false;
@@ -329,30 +732,45 @@ bool Emitter::matchMatMul(MatMulInfo &mmi) {
     bTransFlag = true;
   }
   if (!matchedFlag)
-    return false;
-
-  // check if there is a where clause.
-  auto where = comprehension_.whereClauses();
+    return matchGroupedMatMul(mmi);
+
+  // check if there is a where clause, range constraints only carry
+  // extents.
+  TreeList where;
+  for (const auto &clause : comprehension_.whereClauses())
+    if (clause->kind() != TK_RANGE_CONSTRAINT)
+      where.push_back(clause);
   if (where.size() > 1)
     throw ErrorReport(comprehension_) << "expect single where clause.";
 
-  int letSize = 1;
   std::string letVar = "nullptr";
+  std::vector<std::string> factors;
   if (where.size() == 1) {
     auto let = Let(where[0]);
     letVar = let.name().name();
     applyRecursive(let.rhs(), [&](const TreeRef &t) {
       if (t->kind() == TK_IDENT)
-        letSize++;
+        factors.push_back(Ident(t).name());
     });
+    // the let groups dimensions of the operands in place, the loops run
+    // over its factors.
+    mmi.dims = getLoopDims();
+    mmi.dims.parallel.clear();
+    for (const auto &index : comprehension_.indices()) {
+      if (index.name() == letVar)
+        mmi.dims.parallel.insert(mmi.dims.parallel.end(), factors.begin(),
+                                 factors.end());
+      else
+        mmi.dims.parallel.push_back(index.name());
+    }
   }
 
   // fill mmi.
   mmi.transa = (aTransFlag) ? Trans::T : Trans::N;
   mmi.transb = (bTransFlag) ? Trans::T : Trans::N;
-  mmi.dimensionsForM = (letVar == mmi.m) ? letSize - 1 : 1;
-  mmi.dimensionsForN = (letVar == mmi.n) ? letSize - 1 : 1;
-  mmi.dimensionsForK = (letVar == mmi.k) ? letSize - 1 : 1;
+  mmi.dimensionsForM = (letVar == mmi.m) ? factors.size() : 1;
+  mmi.dimensionsForN = (letVar == mmi.n) ? factors.size() : 1;
+  mmi.dimensionsForK = (letVar == mmi.k) ? factors.size() : 1;
   return true;
 }
 
@@ -382,7 +800,241 @@ std::string toString(Trans t) {
   return "null";
 }
 
+// Return the element type of a typed tactic parameter, i.e., "bf16".
+static std::string toElementType(const TreeRef &scalarType) {
+  TypeInfo type(scalarType);
+  auto bits = std::to_string(type.bits());
+  switch (type.code()) {
+  case TypeInfo::Int:
+    return "i" + bits;
+  case TypeInfo::UInt:
+    return (type.bits() == 1) ? "i1" : "ui" + bits;
+  case TypeInfo::Float:
+    return "f" + bits;
+  case TypeInfo::BFloat:
+    return "bf" + bits;
+  }
+  llvm_unreachable("unknown type code");
+}
+
+// Half precision inputs are accumulated in single precision, narrow
+// integers in 32-bit integers.
+static std::string getAccumulatorType(const std::string &inputType) {
+  if (inputType == "f16" || inputType == "bf16")
+    return "f32";
+  if (inputType == "i8" || inputType == "ui8" || inputType == "i16" ||
+      inputType == "ui16")
+    return "i32";
+  return inputType;
+}
+
+// Return true if the matmul inputs are typed. The accumulator type is
+// derived from the output if typed, otherwise from the inputs.
+bool Emitter::getElementTypes(const MatMulInfo &mmi, std::string &inputType,
+                              std::string &accumulatorType) {
+  auto a = elementTypes_.find(mmi.A);
+  auto b = elementTypes_.find(mmi.B);
+  if (a == elementTypes_.end() || b == elementTypes_.end())
+    return false;
+  if (a->second != b->second)
+    throw ErrorReport(comprehension_.rhs())
+        << "expect inputs with the same element type but got " << a->second
+        << " and " << b->second;
+  inputType = a->second;
+  auto c = elementTypes_.find(mmi.C);
+  accumulatorType =
+      getAccumulatorType((c != elementTypes_.end()) ? c->second : inputType);
+  return true;
+}
+
+// Loops of the statement, derived here as Sema does not run on tactics
+// and the reduction variables of the comprehension are not filled: the
+// output indices are parallel, the other indices of the accesses are
+// reductions. Indices bound with where f = a * c stand for their factors.
+LoopDims Emitter::getLoopDims() const {
+  std::map<std::string, std::vector<std::string>> factors;
+  for (const auto &where : comprehension_.whereClauses()) {
+    if (where->kind() != TK_LET)
+      continue;
+    auto let = Let(where);
+    applyRecursive(let.rhs(), [&](const TreeRef &t) {
+      if (t->kind() == TK_IDENT)
+        factors[let.name().name()].push_back(Ident(t).name());
+    });
+  }
+  auto expand = [&](const std::string &index) {
+    auto it = factors.find(index);
+    return (it != factors.end()) ? it->second
+                                 : std::vector<std::string>{index};
+  };
+
+  LoopDims dims;
+  std::vector<std::string> outFactors;
+  for (const auto &index : comprehension_.indices()) {
+    dims.parallel.push_back(index.name());
+    for (const auto &factor : expand(index.name()))
+      outFactors.push_back(factor);
+  }
+  applyRecursive(comprehension_.rhs(), [&](const TreeRef &t) {
+    if (t->kind() != TK_APPLY ||
+        builtin_functions.count(Apply(t).name().name()))
+      return;
+    for (const auto &arg : Apply(t).arguments())
+      applyRecursive(arg, [&](const TreeRef &e) {
+        if (e->kind() != TK_IDENT)
+          return;
+        for (const auto &factor : expand(Ident(e).name()))
+          if (!find(factor, outFactors) && !find(factor, dims.reduction))
+            dims.reduction.push_back(factor);
+      });
+  });
+  return dims;
+}
+
+void Emitter::emitLoopDims(const LoopDims &dims) {
+  if (dims.parallel.empty() && dims.reduction.empty()) {
+    auto loops = getLoopDims();
+    if (!loops.parallel.empty() || !loops.reduction.empty())
+      return emitLoopDims(loops);
+  }
+  auto emitList = [&](const std::vector<std::string> &indices) {
+    for (size_t i = 0; i < indices.size(); i++)
+      os << ((i == 0) ? "" : ",") << "\"" << indices[i] << "\"";
+  };
+  os << ", Parallel<[";
+  emitList(dims.parallel);
+  os << "]>, Reduction<[";
+  emitList(dims.reduction);
+  os << "]>";
+}
+
+// Largest edge of square tiles, one per operand with elements of
+// "elementSizes" bytes, that fit together in "cacheSize", rounded down to a
+// multiple of the vector length of the first operand.
+static int64_t getTileSize(const TargetInfo &target, int64_t cacheSize,
+                           const std::vector<int64_t> &elementSizes) {
+  int64_t bytes = 0;
+  for (auto elementSize : elementSizes)
+    bytes += elementSize;
+  int64_t lanes =
+      std::max<int64_t>(target.vectorWidth / elementSizes.front(), 1);
+  int64_t size = std::sqrt(cacheSize / bytes);
+  if (size >= lanes)
+    size -= size % lanes;
+  return std::max<int64_t>(size, 1);
+}
+
+static void emitTiles(const std::vector<std::vector<int64_t>> &tiles,
+                      llvm::raw_ostream &os) {
+  if (tiles.empty())
+    return;
+  os << ", Tiles<\"{";
+  for (size_t i = 0; i < tiles.size(); i++) {
+    os << ((i != 0) ? ", {" : "{");
+    for (size_t j = 0; j < tiles[i].size(); j++)
+      os << ((j != 0) ? ", " : "") << tiles[i][j];
+    os << "}";
+  }
+  os << "}\">";
+}
+
+// Block the matmul for each cache level: the tiles of A, B and C must fit
+// together in the cache. The M, N and K extents must be known.
+void Emitter::getMatMulTiles(MatMulInfo &mmi) {
+  std::map<std::string, int64_t> extents;
+  if (!getExtents(comprehension_, extents))
+    return;
+  Tensor a, b;
+  std::string alpha;
+  if (!matchProduct(comprehension_.rhs(), a, b, alpha))
+    return;
+  if (a.name_ != mmi.A)
+    std::swap(a, b);
+  std::vector<std::string> outIndices;
+  for (const auto &index : comprehension_.indices())
+    outIndices.push_back(index.name());
+
+  int64_t m = 1, n = 1, k = 1;
+  for (const auto &index : a.indices_) {
+    if (!extents.count(index))
+      return;
+    (find(index, outIndices) ? m : k) *= extents.at(index);
+  }
+  for (const auto &index : b.indices_) {
+    if (!extents.count(index))
+      return;
+    if (find(index, outIndices))
+      n *= extents.at(index);
+  }
+  mmi.tiles.clear();
+  for (auto cacheSize :
+       {target_.l1CacheSize, target_.l2CacheSize, target_.l3CacheSize}) {
+    auto size = getTileSize(target_, cacheSize,
+                            {getElementSize(mmi.A), getElementSize(mmi.B),
+                             getElementSize(mmi.C)});
+    mmi.tiles.push_back(
+        {std::min(m, size), std::min(n, size), std::min(k, size)});
+  }
+}
+
+// Return the element size of "name" in bytes, the target one if neither
+// "name" nor its storage are typed.
+int64_t Emitter::getElementSize(const std::string &name) const {
+  for (const auto &tensor : {name, symbolTable_.getStorage(name)}) {
+    auto it = elementSizes_.find(tensor);
+    if (it != elementSizes_.end())
+      return it->second;
+  }
+  return target_.elementSize;
+}
+
+// Return the storage format of "name", empty if dense.
+std::string Emitter::getStorageFormat(const std::string &name) const {
+  auto it = storageFormats_.find(name);
+  return (it != storageFormats_.end()) ? it->second : "";
+}
+
+// C(i, j) += A(i, k) * B(k, j) with a sparse A or B.
+void Emitter::emitSpMM(const MatMulInfo &mmi) {
+  auto formatA = getStorageFormat(mmi.A);
+  auto formatB = getStorageFormat(mmi.B);
+  if (!formatA.empty() && !formatB.empty())
+    throw ErrorReport(comprehension_.rhs())
+        << "expect a single sparse operand but got " << mmi.A << " and "
+        << mmi.B;
+  if (!getStorageFormat(mmi.C).empty())
+    throw ErrorReport(comprehension_.rhs())
+        << "expect a dense output but got " << mmi.C;
+  bool sparseA = !formatA.empty();
+  if ((sparseA && (mmi.dimensionsForM != 1 || mmi.dimensionsForK != 1)) ||
+      (!sparseA && (mmi.dimensionsForK != 1 || mmi.dimensionsForN != 1)))
+    throw ErrorReport(comprehension_.rhs()) << "expect a 2-d sparse operand";
+  os.indent(2) << "spmmBuilder<"
+               << "SparseOperand<\"" << (sparseA ? mmi.A : mmi.B) << "\", \""
+               << (sparseA ? formatA : formatB) << "\">, "
+               << "StrExpr<\"" << toString(mmi.transa) << "\">, "
+               << "StrExpr<\"" << toString(mmi.transb) << "\">, "
+               << "Constant<\"" << mmi.alpha << "\">, "
+               << "Constant<\"" << mmi.beta << "\">, "
+               << "Inputs<["
+               << "\"" << mmi.A << "\""
+               << ","
+               << "\"" << mmi.B << "\"";
+  for (const auto &input : mmi.epilogueInputs)
+    os << ","
+       << "\"" << input << "\"";
+  os << "]>, Outputs<["
+     << "\"" << mmi.C << "\""
+     << "]>";
+  if (!mmi.epilogue.empty())
+    os << ", Epilogue<\"" << mmi.epilogue << "\">";
+  emitLoopDims(mmi.dims);
+  os << ">,\n";
+}
+
 void Emitter::emitMatMul(const MatMulInfo &mmi) {
+  if (!getStorageFormat(mmi.A).empty() || !getStorageFormat(mmi.B).empty())
+    return emitSpMM(mmi);
   os.indent(2) << "matmulBuilder<"
                << "StrExpr<\"" << toString(mmi.transa) << "\">, "
                << "StrExpr<\"" << toString(mmi.transb) << "\">, "
@@ -394,13 +1046,49 @@ void Emitter::emitMatMul(const MatMulInfo &mmi) {
                << "Inputs<["
                << "\"" << mmi.A << "\""
                << ","
-               << "\"" << mmi.B << "\""
+               << "\"" << mmi.B << "\"";
+  for (const auto &input : mmi.epilogueInputs)
+    os << ","
+       << "\"" << input << "\"";
+  os << "]>, Outputs<["
+     << "\"" << mmi.C << "\""
+     << "]>";
+  if (!mmi.epilogue.empty())
+    os << ", Epilogue<\"" << mmi.epilogue << "\">";
+  std::string inputType, accumulatorType;
+  if (getElementTypes(mmi, inputType, accumulatorType))
+    os << ", InputType<\"" << inputType << "\">, AccumulatorType<\""
+       << accumulatorType << "\">";
+  emitTiles(mmi.tiles, os);
+  emitLoopDims(mmi.dims);
+  os << ">,\n";
+}
+
+// x(i) += A(i, j) * y(j) with a sparse A.
+void Emitter::emitSpMV(const MatVecInfo &mvi) {
+  if (!getStorageFormat(mvi.y).empty() || !getStorageFormat(mvi.x).empty())
+    throw ErrorReport(comprehension_.rhs())
+        << "expect dense vectors but got " << mvi.y << " and " << mvi.x;
+  os.indent(2) << "spmvBuilder<"
+               << "SparseOperand<\"" << mvi.A << "\", \""
+               << getStorageFormat(mvi.A) << "\">, "
+               << "StrExpr<\"" << toString(mvi.transa) << "\">, "
+               << "Inputs<["
+               << "\"" << mvi.A << "\""
+               << ","
+               << "\"" << mvi.y << "\""
                << "]>, Outputs<["
-               << "\"" << mmi.C << "\""
-               << "]>>,\n";
+               << "\"" << mvi.x << "\""
+               << "]>, "
+               << "Constant<\"" << mvi.alpha << "\">, "
+               << "Constant<\"" << mvi.beta << "\">";
+  emitLoopDims();
+  os << ">,\n";
 }
 
 void Emitter::emitMatVec(const MatVecInfo &mvi) {
+  if (!getStorageFormat(mvi.A).empty())
+    return emitSpMV(mvi);
   os.indent(2) << "matvecBuilder<"
                << "StrExpr<\"" << toString(mvi.transa) << "\">, "
                << "Inputs<["
@@ -411,62 +1099,517 @@ void Emitter::emitMatVec(const MatVecInfo &mvi) {
                << "\"" << mvi.x << "\""
                << "]>, "
                << "Constant<\"" << mvi.alpha << "\">, "
-               << "Constant<\"" << mvi.beta << "\">>, \n";
+               << "Constant<\"" << mvi.beta << "\">";
+  emitLoopDims();
+  os << ">,\n";
+}
+
+// Return true if "t" is a product of accesses that reduces at least
+// one index not in "outIndices".
+static bool isContraction(const TreeRef &t,
+                          const std::vector<std::string> &outIndices) {
+  Tensor a, b;
+  std::string alpha;
+  if (!matchProduct(t, a, b, alpha))
+    return false;
+  for (const auto &index : a.indices_)
+    if (!find(index, outIndices))
+      return true;
+  return false;
+}
+
+// Return true if "t" can be computed pointwise on the output tile: only
+// constants, scalars and accesses indexed by output indices.
+static bool isPointwise(const TreeRef &t,
+                        const std::vector<std::string> &outIndices,
+                        std::vector<std::string> &inputs) {
+  bool pointwise = true;
+  applyRecursive(t, [&](const TreeRef &e) {
+    if (e->kind() != TK_APPLY)
+      return;
+    auto name = Apply(e).name().name();
+    if (builtin_functions.count(name))
+      return;
+    for (const auto &arg : Apply(e).arguments())
+      if (arg->kind() != TK_IDENT || !find(Ident(arg).name(), outIndices))
+        pointwise = false;
+    if (!find(name, inputs))
+      inputs.push_back(name);
+  });
+  return pointwise;
+}
+
+// Peel the elementwise operations off "t" down to the contraction, as
+// recognized by "isProduct". Each operation must have exactly one operand
+// containing the contraction and pointwise remaining operands.
+static TreeRef
+getContraction(const TreeRef &t, const std::vector<std::string> &outIndices,
+               std::vector<std::string> &inputs,
+               const std::function<bool(const TreeRef &)> &isProduct) {
+  if (isProduct(t))
+    return t;
+  switch (t->kind()) {
+  case '+':
+  case '-':
+  case '*':
+  case '/':
+  case TK_MIN:
+  case TK_MAX:
+  case TK_CAST:
+    break;
+  case TK_APPLY:
+    if (builtin_functions.count(Apply(t).name().name()))
+      break;
+    return nullptr;
+  default:
+    return nullptr;
+  }
+  TreeList operands = t->trees();
+  if (t->kind() == TK_APPLY)
+    operands = Apply(t).arguments().tree()->trees();
+  else if (t->kind() == TK_CAST)
+    operands = {Cast(t).value()};
+  TreeRef contraction = nullptr;
+  for (const auto &operand : operands) {
+    auto c = getContraction(operand, outIndices, inputs, isProduct);
+    if (c && contraction)
+      return nullptr;
+    if (c)
+      contraction = c;
+    else if (!isPointwise(operand, outIndices, inputs))
+      return nullptr;
+  }
+  return contraction;
+}
+
+// check if we are dealing with a matmul followed by elementwise
+// operations (i.e., C(i, j) = tanh(A(i, k) * B(k, j) + bias(j))).
+bool Emitter::matchMatMulWithEpilogue(MatMulInfo &mmi) {
+  auto assignment = comprehension_.assignment()->kind();
+  if (assignment != '=' && assignment != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.whereClauses().size())
+    return false;
+  std::vector<std::string> outIndices, inputs;
+  for (const auto &index : comprehension_.indices())
+    outIndices.push_back(index.name());
+  auto rhs = comprehension_.rhs();
+  auto contraction =
+      getContraction(rhs, outIndices, inputs, [&](const TreeRef &t) {
+        return isContraction(t, outIndices);
+      });
+  if (!contraction)
+    return false;
+  // a += reduces the whole rhs, the epilogue cannot be applied once to the
+  // accumulator.
+  if (contraction != rhs && assignment != '=')
+    return false;
+
+  auto c = comprehension_;
+  auto matmul = Comprehension::create(
+      c.range(), c.ident(), c.indices(),
+      Compound::create(TK_PLUS_EQ, c.assignment()->range(), {}), contraction,
+      List::create(c.range(), {}), c.equivalent(), c.reductionVariables());
+  if (!Emitter(Comprehension(matmul), os).matchMatMul(mmi))
+    return false;
+  if (find(mmi.C, inputs))
+    return false;
+  if (contraction != rhs) {
+    std::string epilogue;
+    llvm::raw_string_ostream eos(epilogue);
+    recursivelyEmitRhs(rhs, eos, contraction);
+    mmi.epilogue = eos.str();
+    mmi.epilogueInputs = inputs;
+  }
+  // the output is overwritten.
+  if (assignment == '=')
+    mmi.beta = "0";
+  return true;
 }
 
 bool Emitter::matchAndEmitMatMul() {
   MatMulInfo mmi;
-  if (matchMatMul(mmi)) {
+  if (matchMatMul(mmi) || matchMatMulWithEpilogue(mmi)) {
+    getMatMulTiles(mmi);
     emitMatMul(mmi);
     return true;
   }
   return false;
 }
 
-bool Emitter::matchAndEmitMatVec() {
-  MatVecInfo mvi;
-  if (matchMatVec(mvi)) {
-    emitMatVec(mvi);
-    return true;
+// Match int32(A(...)) or int32(A(...)) - zeroPoint, "type" is the
+// accumulator type of the integer cast.
+static bool getQuantizedOperand(const TreeRef &t, TreeRef &access,
+                                std::string &zeroPoint, int &type) {
+  auto cast = t;
+  zeroPoint = "0";
+  if (t->kind() == '-') {
+    // a unary minus is not a zero point.
+    if (t->trees().size() != 2 || !getScalar(t->tree(1), zeroPoint))
+      return false;
+    cast = t->tree(0);
   }
-  return false;
+  if (cast->kind() != TK_CAST)
+    return false;
+  type = Cast(cast).type()->kind();
+  if (TypeInfo(Cast(cast).type()).is_float() || type == TK_BOOL)
+    return false;
+  Tensor tensor;
+  access = Cast(cast).value();
+  return getAccess(access, tensor);
 }
 
-// check A[...] = X[...]
-bool Emitter::matchReshape(ReshapeInfo &ri) {
-  if (comprehension_.assignment()->kind() != '=')
+// Return true if "t" is a product of two quantized operands widened to
+// the same integer type.
+static bool isQuantizedProduct(const TreeRef &t) {
+  if (t->kind() != '*')
+    return false;
+  TreeRef a, b;
+  std::string za, zb;
+  int typeA, typeB;
+  return getQuantizedOperand(t->tree(0), a, za, typeA) &&
+         getQuantizedOperand(t->tree(1), b, zb, typeB) && typeA == typeB;
+}
+
+// check if we are dealing with a quantized matmul, possibly followed by a
+// requantization (i.e., C(i, j) = int8((int32(A(i, k)) - za) *
+// (int32(B(k, j)) - zb) * scale(j))).
+bool Emitter::matchQuantizedMatMul(QuantizedMatMulInfo &qi) {
+  auto assignment = comprehension_.assignment()->kind();
+  if (assignment != '=' && assignment != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.whereClauses().size())
     return false;
+  std::vector<std::string> outIndices, inputs;
+  for (const auto &index : comprehension_.indices())
+    outIndices.push_back(index.name());
   auto rhs = comprehension_.rhs();
-  int rhsOperands = 0;
-  applyRecursive(rhs, [&](const TreeRef &t) {
-    if (t->kind() == TK_APPLY)
-      rhsOperands++;
-  });
-  if (rhsOperands != 1)
+  auto product = getContraction(rhs, outIndices, inputs, isQuantizedProduct);
+  if (!product)
     return false;
-
-  auto lhsIndexes = comprehension_.indices();
-  auto rhsIndexes = Apply(rhs).arguments();
-  if (lhsIndexes.size() == rhsIndexes.size())
+  // the requantization applies to the reduced accumulator, not to each
+  // term of a +=.
+  if (product != rhs && assignment != '=')
     return false;
 
-  // all the reshape operation must have one where clause.
-  auto where = comprehension_.whereClauses();
-  // if (where.size() != 1)
-  //  return false;
-
-  // fill ri.
-  ri.lhs = comprehension_.ident().name();
-  ri.rhs = Apply(comprehension_.rhs()).name().name();
-
-  for (const auto &elem : lhsIndexes) {
-    ri.lhsIndexes.push_back(elem.name());
+  TreeRef a, b;
+  int type;
+  getQuantizedOperand(product->tree(0), a, qi.zeroPointA, type);
+  getQuantizedOperand(product->tree(1), b, qi.zeroPointB, type);
+  qi.accumulatorType =
+      toElementType(Compound::create(type, product->range(), {}));
+
+  auto &mmi = qi.mmi;
+  auto c = comprehension_;
+  auto matmul = Comprehension::create(
+      c.range(), c.ident(), c.indices(),
+      Compound::create(TK_PLUS_EQ, c.assignment()->range(), {}),
+      Compound::create('*', product->range(), {a, b}),
+      List::create(c.range(), {}), c.equivalent(), c.reductionVariables());
+  if (!Emitter(Comprehension(matmul), os).matchMatMul(mmi))
+    return false;
+  if (find(mmi.C, inputs))
+    return false;
+  // typed operands must be 8-bit integers.
+  for (const auto &name : {mmi.A, mmi.B}) {
+    auto it = elementTypes_.find(name);
+    if (it != elementTypes_.end() && it->second != "i8" && it->second != "ui8")
+      return false;
   }
-  for (const auto &elem : rhsIndexes) {
-    ri.rhsIndexes.push_back(Ident(elem).name());
+  if (product != rhs) {
+    std::string epilogue;
+    llvm::raw_string_ostream eos(epilogue);
+    recursivelyEmitRhs(rhs, eos, product);
+    mmi.epilogue = eos.str();
+    mmi.epilogueInputs = inputs;
   }
+  // the output is overwritten.
+  if (assignment == '=')
+    mmi.beta = "0";
+  return true;
+}
 
-  for (size_t i = 0; i < where.size(); i++) {
+void Emitter::emitQuantizedMatMul(const QuantizedMatMulInfo &qi) {
+  const auto &mmi = qi.mmi;
+  os.indent(2) << "quantizedMatmulBuilder<"
+               << "StrExpr<\"" << toString(mmi.transa) << "\">, "
+               << "StrExpr<\"" << toString(mmi.transb) << "\">, "
+               << "M<" << mmi.dimensionsForM << ">, "
+               << "N<" << mmi.dimensionsForN << ">, "
+               << "K<" << mmi.dimensionsForK << ">, "
+               << "Constant<\"" << mmi.beta << "\">, "
+               << "ZeroPoints<\"" << qi.zeroPointA << "\", \""
+               << qi.zeroPointB << "\">, "
+               << "Inputs<["
+               << "\"" << mmi.A << "\""
+               << ","
+               << "\"" << mmi.B << "\"";
+  for (const auto &input : mmi.epilogueInputs)
+    os << ","
+       << "\"" << input << "\"";
+  os << "]>, Outputs<["
+     << "\"" << mmi.C << "\""
+     << "]>, AccumulatorType<\"" << qi.accumulatorType << "\">";
+  if (!mmi.epilogue.empty())
+    os << ", Epilogue<\"" << mmi.epilogue << "\">";
+  emitLoopDims(mmi.dims);
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitQuantizedMatMul() {
+  QuantizedMatMulInfo qi;
+  if (matchQuantizedMatMul(qi)) {
+    emitQuantizedMatMul(qi);
+    return true;
+  }
+  return false;
+}
+
+bool Emitter::matchAndEmitMatVec() {
+  MatVecInfo mvi;
+  if (matchMatVec(mvi)) {
+    emitMatVec(mvi);
+    return true;
+  }
+  return false;
+}
+
+// check if we are dealing with a dot product.
+bool Emitter::matchDot(DotInfo &di) {
+  using namespace matchers;
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.indices().size() != 0)
+    return false;
+  auto ctx = m_ctx();
+  auto _x = m_ArrayPlaceholder();
+  auto _y = m_ArrayPlaceholder();
+  auto _i = m_Placeholder();
+  auto matcher = m_Mul(m_Access(_x({_i})), m_Access(_y({_i})));
+  if (!matcher.match(comprehension_.rhs()))
+    return false;
+  auto s = comprehension_.ident().name();
+  if ((s == ctx[_x]) || (s == ctx[_y]))
+    return false;
+  di.s = s;
+  di.x = ctx[_x];
+  di.y = ctx[_y];
+  return true;
+}
+
+// check if we are dealing with an axpy.
+bool Emitter::matchAxpy(AxpyInfo &ai) {
+  using namespace matchers;
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  auto indexY = comprehension_.indices();
+  if (indexY.size() != 1)
+    return false;
+  auto ctx = m_ctx();
+  auto _x = m_ArrayPlaceholder();
+  auto _i = m_Placeholder();
+  auto rhs = comprehension_.rhs();
+  ai.alpha = "1";
+  if (!m_Access(_x({_i})).match(rhs)) {
+    if (!m_Mul(m_Any(), m_Access(_x({_i}))).match(rhs))
+      return false;
+    if (!getScalar(rhs->tree(0), ai.alpha))
+      return false;
+  }
+  auto y = comprehension_.ident().name();
+  if ((y == ctx[_x]) || (indexY[0].name() != ctx[_i]))
+    return false;
+  ai.y = y;
+  ai.x = ctx[_x];
+  return true;
+}
+
+// check if we are dealing with a scal.
+bool Emitter::matchScal(ScalInfo &si) {
+  using namespace matchers;
+  auto indexX = comprehension_.indices();
+  if (indexX.size() != 1)
+    return false;
+  auto x = comprehension_.ident().name();
+  auto rhs = comprehension_.rhs();
+  // x(i) *= alpha.
+  if (comprehension_.assignment()->kind() == TK_TIMES_EQ) {
+    si.x = x;
+    return getScalar(rhs, si.alpha);
+  }
+  if (comprehension_.assignment()->kind() != '=')
+    return false;
+  auto ctx = m_ctx();
+  auto _x = m_ArrayPlaceholder();
+  auto _i = m_Placeholder();
+  if (!m_Mul(m_Any(), m_Access(_x({_i}))).match(rhs))
+    return false;
+  if ((x != ctx[_x]) || (indexX[0].name() != ctx[_i]))
+    return false;
+  si.x = x;
+  return getScalar(rhs->tree(0), si.alpha);
+}
+
+// check if we are dealing with an outer product (rank-1 update).
+bool Emitter::matchGer(GerInfo &gi) {
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.whereClauses().size())
+    return false;
+  auto indices = comprehension_.indices();
+  if (indices.size() != 2 || indices[0].name() == indices[1].name())
+    return false;
+  // alpha * (x(i) * y(j)), (alpha * x(i)) * y(j) or x(i) * y(j).
+  auto rhs = comprehension_.rhs();
+  Tensor x, y;
+  if (!matchProduct(rhs, x, y, gi.alpha)) {
+    if (rhs->kind() != '*' || rhs->tree(0)->kind() != '*')
+      return false;
+    if (!getScalar(rhs->tree(0)->tree(0), gi.alpha) ||
+        !getAccess(rhs->tree(0)->tree(1), x) || !getAccess(rhs->tree(1), y))
+      return false;
+  }
+  if (x.indices_.size() != 1 || y.indices_.size() != 1)
+    return false;
+  if (x.indices_[0] != indices[0].name())
+    std::swap(x, y);
+  if (x.indices_[0] != indices[0].name() || y.indices_[0] != indices[1].name())
+    return false;
+  gi.C = comprehension_.ident().name();
+  if (gi.C == x.name_ || gi.C == y.name_)
+    return false;
+  gi.x = x.name_;
+  gi.y = y.name_;
+  return true;
+}
+
+void Emitter::emitGer(const GerInfo &gi) {
+  os.indent(2) << "gerBuilder<"
+               << "Inputs<["
+               << "\"" << gi.x << "\""
+               << ","
+               << "\"" << gi.y << "\""
+               << "]>, Outputs<["
+               << "\"" << gi.C << "\""
+               << "]>, "
+               << "Constant<\"" << gi.alpha << "\">";
+  emitLoopDims();
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitGer() {
+  GerInfo gi;
+  if (matchGer(gi)) {
+    emitGer(gi);
+    return true;
+  }
+  return false;
+}
+
+void Emitter::emitDot(const DotInfo &di) {
+  os.indent(2) << "dotBuilder<"
+               << "Inputs<["
+               << "\"" << di.x << "\""
+               << ","
+               << "\"" << di.y << "\""
+               << "]>, Outputs<["
+               << "\"" << di.s << "\""
+               << "]>";
+  emitLoopDims();
+  os << ">,\n";
+}
+
+void Emitter::emitAxpy(const AxpyInfo &ai) {
+  os.indent(2) << "axpyBuilder<"
+               << "Inputs<["
+               << "\"" << ai.x << "\""
+               << "]>, Outputs<["
+               << "\"" << ai.y << "\""
+               << "]>, "
+               << "Constant<\"" << ai.alpha << "\">";
+  emitLoopDims();
+  os << ">,\n";
+}
+
+void Emitter::emitScal(const ScalInfo &si) {
+  os.indent(2) << "scalBuilder<"
+               << "Inputs<["
+               << "\"" << si.x << "\""
+               << "]>, Outputs<["
+               << "\"" << si.x << "\""
+               << "]>, "
+               << "Constant<\"" << si.alpha << "\">";
+  emitLoopDims();
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitDot() {
+  DotInfo di;
+  if (matchDot(di)) {
+    emitDot(di);
+    return true;
+  }
+  return false;
+}
+
+bool Emitter::matchAndEmitAxpy() {
+  AxpyInfo ai;
+  if (matchAxpy(ai)) {
+    emitAxpy(ai);
+    return true;
+  }
+  return false;
+}
+
+bool Emitter::matchAndEmitScal() {
+  ScalInfo si;
+  if (matchScal(si)) {
+    emitScal(si);
+    return true;
+  }
+  return false;
+}
+
+// check A[...] = X[...]
+bool Emitter::matchReshape(ReshapeInfo &ri) {
+  if (comprehension_.assignment()->kind() != '=')
+    return false;
+  auto rhs = comprehension_.rhs();
+  int rhsOperands = 0;
+  applyRecursive(rhs, [&](const TreeRef &t) {
+    if (t->kind() == TK_APPLY)
+      rhsOperands++;
+  });
+  if (rhsOperands != 1 || rhs->kind() != TK_APPLY)
+    return false;
+
+  auto lhsIndexes = comprehension_.indices();
+  auto rhsIndexes = Apply(rhs).arguments();
+  if (lhsIndexes.size() == rhsIndexes.size())
+    return false;
+
+  // a reshape binds the grouped dimensions with a let, range constraints
+  // only carry extents.
+  TreeList where;
+  for (const auto &clause : comprehension_.whereClauses())
+    if (clause->kind() == TK_LET)
+      where.push_back(clause);
+  if (where.empty())
+    throw ErrorReport(comprehension_)
+        << "expect a where clause binding the reshaped dimensions";
+
+  // fill ri.
+  ri.lhs = comprehension_.ident().name();
+  ri.rhs = Apply(comprehension_.rhs()).name().name();
+
+  for (const auto &elem : lhsIndexes) {
+    ri.lhsIndexes.push_back(elem.name());
+  }
+  for (const auto &elem : rhsIndexes) {
+    ri.rhsIndexes.push_back(Ident(elem).name());
+  }
+
+  for (size_t i = 0; i < where.size(); i++) {
     auto let = Let(where[i]);
     ri.newVar.push_back(let.name().name());
     std::vector<std::string> tmp;
@@ -481,24 +1624,6 @@ bool Emitter::matchReshape(ReshapeInfo &ri) {
   return true;
 }
 
-// helper.
-bool find(const std::string &target,
-          const std::vector<std::string> &arrayToInspect) {
-  auto it = std::find(arrayToInspect.begin(), arrayToInspect.end(), target);
-  if (it == arrayToInspect.end())
-    return false;
-  return true;
-}
-
-// helper.
-bool find(const std::vector<std::string> &targets,
-          const std::vector<std::string> &arrayToInspect) {
-  for (const auto &elem : targets)
-    if (!find(elem, arrayToInspect))
-      return false;
-  return true;
-}
-
 // helper. Find "what" in "target", substitute "what" with "with" and remove
 // "what" from "target".
 void substitute(std::vector<std::string> &target, const std::string what,
@@ -542,230 +1667,153 @@ std::vector<std::string> reorder(const std::vector<std::string> &indexes,
   return res;
 }
 
-std::string getReshapeMap(const std::vector<size_t> &toReshape,
-                          const std::vector<size_t> &notToReshape) {
-  assert(toReshape.size());
-  assert(notToReshape.size());
+// Print the groups of dimensions merged by a reshape, i.e., "{{0, 1}, 2}".
+// A dimension that is not merged is printed alone.
+std::string composeGroup(const std::vector<std::vector<size_t>> &groups) {
   std::string res = "\"{";
-  auto itReshape = std::find(toReshape.begin(), toReshape.end(), 0);
-  auto itNotReshape = std::find(notToReshape.begin(), notToReshape.end(), 0);
-  if ((itReshape == toReshape.end()) && (itNotReshape == notToReshape.end()))
-    assert(0 && "cannot find zero dimension");
-
-  if (itReshape != toReshape.end()) {
-    res += "{";
-    for (size_t i = 0; i < toReshape.size(); i++) {
-      if (i == toReshape.size() - 1) {
-        res += ", ";
-        res += std::to_string(toReshape[i]);
-      } else
-        res += std::to_string(toReshape[i]);
-    }
-    if (notToReshape.size() == 1)
-      res += "}";
-    else
-      res += "}, ";
-    for (size_t i = 0; i < notToReshape.size(); i++) {
-      if (i == notToReshape.size() - 1) {
-        res += ", ";
-        res += std::to_string(notToReshape[i]);
-      } else
-        res += std::to_string(notToReshape[i]);
-    }
-  }
-
-  else {
-    for (size_t i = 0; i < notToReshape.size(); i++) {
-      if (i == notToReshape.size() - 1 && notToReshape.size() != 1) {
-        res += ", ";
-        res += std::to_string(notToReshape[i]);
-      } else
-        res += std::to_string(notToReshape[i]);
-    }
-    if (notToReshape.size() == 1)
-      res += ", {";
-    for (size_t i = 0; i < toReshape.size(); i++) {
-      if (i == toReshape.size() - 1) {
-        res += ", ";
-        res += std::to_string(toReshape[i]);
-      } else
-        res += std::to_string(toReshape[i]);
+  for (size_t i = 0; i < groups.size(); i++) {
+    res += (i == 0) ? "" : ", ";
+    if (groups[i].size() == 1) {
+      res += std::to_string(groups[i][0]);
+      continue;
     }
+    res += "{";
+    for (size_t j = 0; j < groups[i].size(); j++)
+      res += ((j == 0) ? "" : ", ") + std::to_string(groups[i][j]);
     res += "}";
   }
-
   res += "}\"";
   return res;
 }
 
-void getReshapeGroupImpl(std::vector<std::string> oldVars,
-                         std::vector<std::string> indexes,
-                         std::vector<size_t> &group) {
-  for (auto var : oldVars) {
-    auto pos = std::find(indexes.begin(), indexes.end(), var);
-    group.push_back(std::distance(indexes.begin(), pos));
+// Return true if, after expanding the where clauses, the indexes on the
+// two sides of the reshape are not in the same order. In this case the
+// reshape also moves data around and must be paired with a transpose.
+static bool requireTranspose(const ReshapeInfo &ri) {
+  auto lhsIndexesCpy = ri.lhsIndexes;
+  auto rhsIndexesCpy = ri.rhsIndexes;
+  for (size_t i = 0; i < ri.newVar.size(); i++) {
+    if (find(ri.newVar[i], lhsIndexesCpy))
+      substitute(lhsIndexesCpy, ri.newVar[i], ri.oldVars[i]);
+    else
+      substitute(rhsIndexesCpy, ri.newVar[i], ri.oldVars[i]);
   }
+  if (lhsIndexesCpy.size() != rhsIndexesCpy.size())
+    return true;
+  return !isConsecutive(getOrdering(lhsIndexesCpy, rhsIndexesCpy));
 }
 
-std::vector<std::vector<size_t>>
-getReshapeGroup(std::vector<std::string> newVar,
-                std::vector<std::vector<std::string>> oldVars,
-                std::vector<std::string> lhsIndexes,
-                std::vector<std::string> rhsIndexes) {
-  std::vector<std::vector<size_t>> res;
-  for (size_t i = 0; i < newVar.size(); i++) {
-    bool isOnLhs = find(newVar[i], lhsIndexes);
-    bool isOnRhs = find(newVar[i], rhsIndexes);
-    if (!(isOnRhs ^ isOnLhs)) {
-      assert(0 && "cannot be on lhs or rhs");
-    }
+// Print "permutation" as a string expression, i.e., "{2,0,1}".
+static std::string toPermutation(const std::vector<size_t> &permutation) {
+  std::string res = "\"{";
+  for (size_t i = 0; i < permutation.size(); i++)
+    res += ((i == 0) ? "" : ",") + std::to_string(permutation[i]);
+  return res + "}\"";
+}
 
-    std::vector<size_t> group;
-    if (isOnLhs)
-      getReshapeGroupImpl(oldVars[i], rhsIndexes, group);
-    else
-      getReshapeGroupImpl(oldVars[i], lhsIndexes, group);
-    res.push_back(group);
-  }
-  return res;
+// Return true if "rhs" is a view of the storage of "lhs": copying "rhs"
+// into "lhs" without moving the data only restores the layout of "lhs"
+// (i.e., the GEMM of a TTGT already wrote into a view of the output).
+static bool isWriteBack(const std::string &lhs, const std::string &rhs,
+                        const SymbolTableMap &symbolTable) {
+  return lhs != rhs && symbolTable.hasTensor(lhs) &&
+         symbolTable.getStorage(rhs) == symbolTable.getStorage(lhs);
 }
 
-std::string composeGroup(std::vector<std::vector<size_t>> groups) {
-  assert(groups.size() == 2 && "max group size == 2");
-  std::string res = "\"{";
-  for (auto group : groups) {
-    res += "{";
-    for (size_t i = 0; i < group.size(); i++) {
-      if (i == group.size() - 1)
-        res += std::to_string(group[i]);
-      else {
-        res += std::to_string(group[i]);
-        res += ", ";
-      }
-    }
-    res += "}";
-  }
-  res += "}\"";
-  return res;
+static std::string getReshapeBuilder(bool isView) {
+  return (isView) ? "reshapeViewBuilder" : "reshapeBuilder";
 }
 
-void Emitter::printGroup(const ReshapeInfo &ri) {
-  auto groups =
-      getReshapeGroup(ri.newVar, ri.oldVars, ri.lhsIndexes, ri.rhsIndexes);
-  os.indent(2) << "reshapeBuilder<Inputs<[";
-  os << "\"" << ri.rhs << "\""
-     << "]>, Outputs<["
-     << "\"" << ri.lhs << "\"";
-  os << "]>, StrExpr<";
-  os << composeGroup(groups);
-  os << ">>,\n";
+// A reshape that only regroups adjacent dimensions does not move data and
+// can be lowered to a view (i.e., collapse/expand shape) of its input.
+// This is possible only if the output is a fresh tensor: data landing in an
+// existing tensor must be copied.
+bool Emitter::matchView() {
+  ReshapeInfo ri;
+  if (!matchReshape(ri))
+    return false;
+  return !requireTranspose(ri);
 }
 
 void Emitter::emitReshape(const ReshapeInfo &ri) {
   assert(ri.newVar.size() == ri.oldVars.size());
-  // horrible way of handling multiple wheres
-  if (ri.newVar.size() == 2)
-    return printGroup(ri);
-
-  assert(ri.newVar.size() == 1);
-  // Assuming where f = a * c
-  // check if the reshape dimension (f) is on the LHS or RHS.
+  // Assuming where f = a * c, g = d * e check if the reshape dimensions
+  // (f, g) are all on the LHS or all on the RHS.
   bool isOnLhs = find(ri.newVar[0], ri.lhsIndexes);
-  bool isOnRhs = find(ri.newVar[0], ri.rhsIndexes);
-  if (!(isOnRhs ^ isOnLhs))
-    throw ErrorReport(comprehension_)
-        << "You want to reshape " << ri.newVar[0]
-        << "but it is not on the LHS nor on the RHS.";
-
-  // check if a and c are on the RHS if f is on the LHS and viceversa.
-  if (isOnRhs && !find(ri.oldVars[0], ri.lhsIndexes))
-    throw ErrorReport(comprehension_)
-        << "The dimensions you want to rehsape are not in the expected side";
-  if (isOnLhs && !find(ri.oldVars[0], ri.rhsIndexes))
-    throw ErrorReport(comprehension_)
-        << "The dimensions you want to rehsape are not in the expected side";
+  for (size_t i = 0; i < ri.newVar.size(); i++) {
+    bool varIsOnLhs = find(ri.newVar[i], ri.lhsIndexes);
+    bool varIsOnRhs = find(ri.newVar[i], ri.rhsIndexes);
+    if (!(varIsOnRhs ^ varIsOnLhs))
+      throw ErrorReport(comprehension_)
+          << "You want to reshape " << ri.newVar[i]
+          << "but it is not on the LHS nor on the RHS.";
+    if (varIsOnLhs != isOnLhs)
+      throw ErrorReport(comprehension_)
+          << "expect all the reshaped dimensions on the same side";
+
+    // check if a and c are on the RHS if f is on the LHS and viceversa.
+    if (!find(ri.oldVars[i], (isOnLhs) ? ri.rhsIndexes : ri.lhsIndexes))
+      throw ErrorReport(comprehension_)
+          << "The dimensions you want to rehsape are not in the expected side";
+  }
 
+  // substitute f and g.
   auto lhsIndexesCpy = ri.lhsIndexes;
   auto rhsIndexesCpy = ri.rhsIndexes;
-
-  // substitute f.
-  if (isOnLhs)
-    substitute(lhsIndexesCpy, ri.newVar[0], ri.oldVars[0]);
-  else
-    substitute(rhsIndexesCpy, ri.newVar[0], ri.oldVars[0]);
-
-  std::vector<size_t> indexesToReshape;
-  std::vector<size_t> indexesNotToReshape;
-  for (auto elem : ri.oldVars[0]) {
-    auto it = std::find(lhsIndexesCpy.begin(), lhsIndexesCpy.end(), elem);
-    assert(it != lhsIndexesCpy.end());
-    indexesToReshape.push_back(std::distance(lhsIndexesCpy.begin(), it));
-  }
-  assert(lhsIndexesCpy.size() == rhsIndexesCpy.size());
-  for (size_t i = 0; i < lhsIndexesCpy.size(); i++) {
-    auto it = std::find(indexesToReshape.begin(), indexesToReshape.end(), i);
-    if (it == indexesToReshape.end())
-      indexesNotToReshape.push_back(i);
+  for (size_t i = 0; i < ri.newVar.size(); i++)
+    substitute((isOnLhs) ? lhsIndexesCpy : rhsIndexesCpy, ri.newVar[i],
+               ri.oldVars[i]);
+  if (lhsIndexesCpy.size() != rhsIndexesCpy.size())
+    throw ErrorReport(comprehension_)
+        << "expect the same dimensions on both sides of the reshape";
+
+  // each dimension of the collapsed side is a group of dimensions of the
+  // expanded one.
+  const auto &collapsed = (isOnLhs) ? ri.lhsIndexes : ri.rhsIndexes;
+  const auto &expanded = (isOnLhs) ? lhsIndexesCpy : rhsIndexesCpy;
+  std::vector<std::vector<size_t>> groups;
+  for (const auto &index : collapsed) {
+    auto it = std::find(ri.newVar.begin(), ri.newVar.end(), index);
+    std::vector<std::string> vars = {index};
+    if (it != ri.newVar.end())
+      vars = ri.oldVars[std::distance(ri.newVar.begin(), it)];
+    groups.push_back({});
+    for (const auto &var : vars)
+      groups.back().push_back(getPosition(expanded, var));
   }
 
-  // check if we need to transpose.
-  bool requireTranspose = false;
+  // moving and regrouping the data is done in a single pass without an
+  // intermediate: the permutation is over the expanded dimensions, the
+  // groups are the ones of the collapsed side.
   auto ordering = getOrdering(lhsIndexesCpy, rhsIndexesCpy);
-  if (!isConsecutive(ordering))
-    requireTranspose = true;
-
-  // if f is rhs emit first reshape and then transpose
-  // if necessary.
-  if (isOnRhs) {
-    auto it =
-        std::find(ri.rhsIndexes.begin(), ri.rhsIndexes.end(), ri.newVar[0]);
-    auto dist = std::distance(ri.rhsIndexes.begin(), it);
-    indexesToReshape.clear();
-    indexesNotToReshape.clear();
-    for (size_t i = 0; i < ri.rhsIndexes.size(); i++)
-      indexesToReshape.push_back(dist++);
-    for (size_t i = 0; i < rhsIndexesCpy.size(); i++) {
-      auto it = std::find(indexesToReshape.begin(), indexesToReshape.end(), i);
-      if (it == indexesToReshape.end())
-        indexesNotToReshape.push_back(i);
-    }
-    std::string dest =
-        (requireTranspose) ? symbolTable_.getNextVariable() : ri.lhs;
-    os.indent(2) << "reshapeBuilder<Inputs<["
+  if (!isConsecutive(ordering)) {
+    os.indent(2) << "permuteReshapeBuilder<Inputs<["
                  << "\"" << ri.rhs << "\""
                  << "]>, Outputs<["
-                 << "\"" << dest << "\""
-                 << "]>, StrExpr<"
-                 << getReshapeMap(indexesToReshape, indexesNotToReshape)
-                 << ">>,\n";
+                 << "\"" << ri.lhs << "\""
+                 << "]>, StrExpr<" << toPermutation(ordering)
+                 << ">, StrExpr<" << composeGroup(groups) << ">";
+    emitLoopDims({lhsIndexesCpy, {}});
+    os << ">,\n";
+    transposed_.push_back(
+        getSize(ri.rhsIndexes, resolveIndices(comprehension_, symbolTable_)));
+    return;
   }
 
-  bool emittedTranspose = false;
-  if (requireTranspose) {
-    if (isOnRhs)
-      emitTranspose({ri.lhs, symbolTable_.getLastEmittedVariable(), ordering});
-    else
-      emitTranspose({symbolTable_.getNextVariable(), ri.rhs, ordering});
-    emittedTranspose = true;
-  }
+  // the output already holds the data if the input is a view of it.
+  if (isWriteBack(ri.lhs, ri.rhs, symbolTable_))
+    return;
 
-  if (isOnLhs) {
-    auto newLhs =
-        (emittedTranspose) ? symbolTable_.getLastEmittedVariable() : ri.lhs;
-    os.indent(2) << "reshapeBuilder<Inputs<[";
-    if (!emittedTranspose) {
-      os << "\"" << ri.rhs << "\""
-         << "]>, Outputs<["
-         << "\"" << newLhs << "\"";
-    } else {
-      os << "\"" << newLhs << "\""
-         << "]>, Outputs<["
-         << "\"" << ri.lhs << "\"";
-    }
-    os << "]>, StrExpr<";
-    os << getReshapeMap(indexesToReshape, indexesNotToReshape);
-    os << ">>,\n";
-  }
+  bool isView = !symbolTable_.hasTensor(ri.lhs);
+  os.indent(2) << getReshapeBuilder(isView) << "<Inputs<["
+               << "\"" << ri.rhs << "\""
+               << "]>, Outputs<["
+               << "\"" << ri.lhs << "\""
+               << "]>, StrExpr<" << composeGroup(groups) << ">";
+  emitLoopDims();
+  os << ">,\n";
+  if (isView)
+    symbolTable_.registerView(ri.lhs, ri.rhs);
 }
 
 bool Emitter::matchAndEmitReshape() {
@@ -782,15 +1830,42 @@ void Emitter::emitTranspose(const TransposeInfo &ti) {
                << "\"" << ti.rhs << "\""
                << "]>, Outputs<["
                << "\"" << ti.lhs << "\""
-               << "]>, StrExpr<"
-               << "\"{";
-  for (size_t i = 0; i < ti.permutation.size(); i++) {
-    if (i == ti.permutation.size() - 1)
-      os << ti.permutation[i];
-    else
-      os << ti.permutation[i] << ",";
+               << "]>, StrExpr<" << toPermutation(ti.permutation) << ">";
+  emitTiles(ti.tiles, os);
+  emitLoopDims(ti.dims);
+  os << ">,\n";
+  auto dims = (ti.dims.parallel.empty()) ? getLoopDims() : ti.dims;
+  transposed_.push_back(getSize(
+      dims.parallel, resolveIndices(comprehension_, symbolTable_)));
+}
+
+// Block the transpose for each cache level on the innermost dimensions of
+// the input and of the output, whose extents must be known. The other
+// dimensions are not tiled.
+void Emitter::getTransposeTiles(TransposeInfo &ti) {
+  std::map<std::string, int64_t> extents;
+  if (!getExtents(comprehension_, extents))
+    return;
+  std::vector<std::string> lhsIndexes;
+  for (const auto &index : comprehension_.indices())
+    lhsIndexes.push_back(index.name());
+  auto rhsIndexes = Apply(comprehension_.rhs()).arguments();
+  auto outIndex = lhsIndexes.back();
+  auto inIndex = Ident(rhsIndexes[rhsIndexes.size() - 1]).name();
+  if (!extents.count(outIndex) || !extents.count(inIndex))
+    return;
+  auto innerOut = lhsIndexes.size() - 1;
+  auto innerIn = getPosition(lhsIndexes, inIndex);
+  ti.tiles.clear();
+  for (auto cacheSize :
+       {target_.l1CacheSize, target_.l2CacheSize, target_.l3CacheSize}) {
+    auto size = getTileSize(target_, cacheSize,
+                            {getElementSize(ti.rhs), getElementSize(ti.lhs)});
+    std::vector<int64_t> tiles(lhsIndexes.size(), 1);
+    tiles[innerOut] = std::min(extents.at(outIndex), size);
+    tiles[innerIn] = std::min(extents.at(inIndex), size);
+    ti.tiles.push_back(tiles);
   }
-  os << "}\">>,\n";
 }
 
 bool Emitter::matchTranspose(TransposeInfo &rti) {
@@ -802,15 +1877,15 @@ bool Emitter::matchTranspose(TransposeInfo &rti) {
     if (t->kind() == TK_APPLY)
       rhsOperands++;
   });
-  if (rhsOperands != 1)
+  if (rhsOperands != 1 || rhs->kind() != TK_APPLY)
     return false;
   auto lhsIndexes = comprehension_.indices();
   auto rhsIndexes = Apply(rhs).arguments();
   if (lhsIndexes.size() != rhsIndexes.size())
     return false;
-  // not where clause allowed.
-  auto where = comprehension_.whereClauses();
-  if (where.size() != 0)
+  // only range constraints are allowed.
+  std::map<std::string, int64_t> extents;
+  if (!getExtents(comprehension_, extents))
     return false;
   std::vector<std::string> lhsIndexesAsStr, rhsIndexesAsStr;
   for (const auto &elem : lhsIndexes)
@@ -829,77 +1904,1293 @@ bool Emitter::matchTranspose(TransposeInfo &rti) {
 bool Emitter::matchAndEmitTranspose() {
   TransposeInfo rti;
   if (matchTranspose(rti)) {
+    if (isConsecutive(rti.permutation) &&
+        isWriteBack(rti.lhs, rti.rhs, symbolTable_))
+      return true;
+    getTransposeTiles(rti);
     emitTranspose(rti);
     return true;
   }
   return false;
 }
 
-// TODO: better handling for conv.
-bool Emitter::matchConv(ConvInfo &cvi) {
-  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+// Return true if "c" is pointwise: an assignment without reductions
+// that is not a plain copy of a single tensor.
+static bool isElementwise(Comprehension c) {
+  if (c.assignment()->kind() != '=' || c.whereClauses().size())
     return false;
-
-  if (comprehension_.indices().size() != 2)
+  if (c.rhs()->kind() == TK_APPLY &&
+      !builtin_functions.count(Apply(c.rhs()).name().name()))
+    return false;
+  std::vector<std::string> outIndices, inputs;
+  for (const auto &index : c.indices()) {
+    if (find(index.name(), outIndices))
+      return false;
+    outIndices.push_back(index.name());
+  }
+  if (!isPointwise(c.rhs(), outIndices, inputs))
     return false;
+  return !inputs.empty() && !find(c.ident().name(), inputs);
+}
 
-  cvi.out = comprehension_.ident().name();
-  cvi.filt = Apply(comprehension_.rhs()->trees().at(0)).name().name();
-  cvi.img = Apply(comprehension_.rhs()->trees().at(1)).name().name();
+bool Emitter::matchElementwise(ElementwiseInfo &ei) {
+  if (!isElementwise(comprehension_))
+    return false;
+  std::vector<std::string> outIndices;
+  for (const auto &index : comprehension_.indices())
+    outIndices.push_back(index.name());
+  isPointwise(comprehension_.rhs(), outIndices, ei.inputs);
+  ei.out = comprehension_.ident().name();
+  llvm::raw_string_ostream eos(ei.expr);
+  eos << ei.out << "(";
+  for (size_t i = 0; i < outIndices.size(); i++)
+    eos << ((i == 0) ? "" : ", ") << outIndices[i];
+  eos << ") = ";
+  recursivelyEmitRhs(comprehension_.rhs(), eos);
+  eos.flush();
   return true;
 }
 
-void Emitter::emitConv(const ConvInfo &cvi) {
-  os.indent(2) << "convBuilder<"
-               << "Inputs<["
-               << "\"" << cvi.filt << "\""
-               << ", "
-               << "\"" << cvi.img << "\""
-               << "]>, Outputs<["
-               << "\"" << cvi.out << "\""
-               << "]>, StrExpr<\"{1, 1, 1, 1}\">, StrExpr<\"{0, 0}\">>,\n";
-  return;
+void Emitter::emitElementwise(const ElementwiseInfo &ei) {
+  os.indent(2) << "elementwiseBuilder<Inputs<[";
+  for (size_t i = 0; i < ei.inputs.size(); i++)
+    os << ((i == 0) ? "" : ",") << "\"" << ei.inputs[i] << "\"";
+  os << "]>, Outputs<["
+     << "\"" << ei.out << "\""
+     << "]>, StrExpr<\"" << ei.expr << "\">";
+  emitLoopDims();
+  os << ">,\n";
 }
 
-bool Emitter::matchAndEmitConv() {
-  ConvInfo cvi;
-  if (matchConv(cvi)) {
-    emitConv(cvi);
+bool Emitter::matchAndEmitElementwise() {
+  ElementwiseInfo ei;
+  if (matchElementwise(ei)) {
+    emitElementwise(ei);
     return true;
   }
   return false;
 }
 
-void Emitter::emitHow() {
-
-  if (matchAndEmitMatMul())
-    return;
-  if (matchAndEmitMatVec())
-    return;
-
-  if (matchAndEmitReshape())
-    return;
-  if (matchAndEmitTranspose())
-    return;
-
-  if (matchAndEmitConv())
-    return;
+static std::string toString(const std::vector<size_t> &dims) {
+  std::string res = "{";
+  for (size_t i = 0; i < dims.size(); i++) {
+    if (i != 0)
+      res += ", ";
+    res += std::to_string(dims[i]);
+  }
+  return res + "}";
+}
+
+// check if we are dealing with a matmul over a semiring other than
+// (+, *), i.e., C(i, j) min= A(i, k) + B(k, j).
+bool Emitter::matchSemiringMatMul(SemiringMatMulInfo &smi) {
+  std::string add, mul;
+  switch (comprehension_.assignment()->kind()) {
+  case TK_MIN_EQ:
+    add = "min";
+    break;
+  case TK_MAX_EQ:
+    add = "max";
+    break;
+  default:
+    return false;
+  }
+  auto rhs = comprehension_.rhs();
+  switch (rhs->kind()) {
+  case '+':
+    mul = "plus";
+    break;
+  case '*':
+    mul = "times";
+    break;
+  // boolean semirings: max= over && is (or, and), min= over || is (and, or).
+  case TK_AND:
+    if (add != "max")
+      return false;
+    add = "or";
+    mul = "and";
+    break;
+  case TK_OR:
+    if (add != "min")
+      return false;
+    add = "and";
+    mul = "or";
+    break;
+  default:
+    return false;
+  }
+  Tensor a, b;
+  if (!getAccess(rhs->tree(0), a) || !getAccess(rhs->tree(1), b))
+    return false;
+
+  // the operands are laid out as for a plain matmul.
+  auto c = comprehension_;
+  auto matmul = Comprehension::create(
+      c.range(), c.ident(), c.indices(),
+      Compound::create(TK_PLUS_EQ, c.assignment()->range(), {}),
+      Compound::create('*', rhs->range(), {rhs->tree(0), rhs->tree(1)}),
+      c.whereClauses(), c.equivalent(), c.reductionVariables());
+  if (!Emitter(Comprehension(matmul), os).matchMatMul(smi.mmi))
+    return false;
+  smi.semiring = add + "-" + mul;
+  // typed operands are packed only if bool.
+  smi.isPacked = mul == "and" || mul == "or";
+  for (const auto &name : {smi.mmi.A, smi.mmi.B}) {
+    auto it = elementTypes_.find(name);
+    if (it != elementTypes_.end() && it->second != "i1")
+      smi.isPacked = false;
+  }
+  return true;
+}
+
+void Emitter::emitSemiringMatMul(const SemiringMatMulInfo &smi) {
+  const auto &mmi = smi.mmi;
+  // boolean operands are packed into 64-bit words, the product is then
+  // computed with bitwise and/or (or popcount) over whole words.
+  os.indent(2) << (smi.isPacked ? "boolean" : "semiring") << "MatmulBuilder<"
+               << "StrExpr<\"" << smi.semiring << "\">, "
+               << "StrExpr<\"" << toString(mmi.transa) << "\">, "
+               << "StrExpr<\"" << toString(mmi.transb) << "\">, "
+               << "M<" << mmi.dimensionsForM << ">, "
+               << "N<" << mmi.dimensionsForN << ">, "
+               << "K<" << mmi.dimensionsForK << ">, ";
+  if (smi.isPacked)
+    os << "Packing<64>, ";
+  os << "Inputs<["
+     << "\"" << mmi.A << "\""
+     << ","
+     << "\"" << mmi.B << "\""
+     << "]>, Outputs<["
+     << "\"" << mmi.C << "\""
+     << "]>";
+  emitLoopDims(mmi.dims);
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitSemiringMatMul() {
+  SemiringMatMulInfo smi;
+  if (matchSemiringMatMul(smi)) {
+    emitSemiringMatMul(smi);
+    return true;
+  }
+  return false;
+}
+
+// Return the transpose flag of the symmetric product a * b, with (i, j)
+// the output indices.
+static bool getSymmetricTrans(const Tensor &a, const Tensor &b,
+                              const std::string &i, const std::string &j,
+                              Trans &trans) {
+  if (a.indices_.size() != 2 || b.indices_.size() != 2)
+    return false;
+  if (a.indices_[0] == i && b.indices_[0] == j &&
+      a.indices_[1] == b.indices_[1]) {
+    trans = Trans::N;
+    return a.indices_[1] != i && a.indices_[1] != j;
+  }
+  if (a.indices_[1] == i && b.indices_[1] == j &&
+      a.indices_[0] == b.indices_[0]) {
+    trans = Trans::T;
+    return a.indices_[0] != i && a.indices_[0] != j;
+  }
+  return false;
+}
+
+// check if we are dealing with a rank-k update: both operands of the
+// matmul are the same tensor.
+bool Emitter::matchSyrk(SyrkInfo &si) {
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.whereClauses().size())
+    return false;
+  auto indices = comprehension_.indices();
+  if (indices.size() != 2 || indices[0].name() == indices[1].name())
+    return false;
+  Tensor a, b;
+  if (!matchProduct(comprehension_.rhs(), a, b, si.alpha))
+    return false;
+  si.C = comprehension_.ident().name();
+  if (a.name_ != b.name_ || si.C == a.name_)
+    return false;
+  if (!getSymmetricTrans(a, b, indices[0].name(), indices[1].name(),
+                         si.trans))
+    return false;
+  si.A = a.name_;
+  si.beta = "1";
+  return true;
+}
+
+// check if we are dealing with a rank-2k update:
+// C(i, j) += A(i, k) * B(j, k) + B(i, k) * A(j, k).
+bool Emitter::matchSyr2k(SyrkInfo &si) {
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.whereClauses().size())
+    return false;
+  auto indices = comprehension_.indices();
+  if (indices.size() != 2 || indices[0].name() == indices[1].name())
+    return false;
+  auto rhs = comprehension_.rhs();
+  if (rhs->kind() != '+')
+    return false;
+  Tensor a1, b1, a2, b2;
+  std::string alpha;
+  if (!matchProduct(rhs->tree(0), a1, b1, si.alpha) ||
+      !matchProduct(rhs->tree(1), a2, b2, alpha) || alpha != si.alpha)
+    return false;
+  si.C = comprehension_.ident().name();
+  if (a1.name_ == b1.name_ || a1.name_ != b2.name_ || b1.name_ != a2.name_)
+    return false;
+  if (si.C == a1.name_ || si.C == b1.name_)
+    return false;
+  Trans trans;
+  if (!getSymmetricTrans(a1, b1, indices[0].name(), indices[1].name(),
+                         si.trans) ||
+      !getSymmetricTrans(a2, b2, indices[0].name(), indices[1].name(),
+                         trans) ||
+      trans != si.trans)
+    return false;
+  si.A = a1.name_;
+  si.B = b1.name_;
+  si.beta = "1";
+  return true;
+}
+
+void Emitter::emitSyrk(const SyrkInfo &si) {
+  os.indent(2) << ((si.B.empty()) ? "syrkBuilder<" : "syr2kBuilder<")
+               << "StrExpr<\"L\">, "
+               << "StrExpr<\"" << toString(si.trans) << "\">, "
+               << "Constant<\"" << si.alpha << "\">, "
+               << "Constant<\"" << si.beta << "\">, "
+               << "Inputs<["
+               << "\"" << si.A << "\"";
+  if (!si.B.empty())
+    os << ","
+       << "\"" << si.B << "\"";
+  os << "]>, Outputs<["
+     << "\"" << si.C << "\""
+     << "]>";
+  emitLoopDims();
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitSyrk() {
+  SyrkInfo si;
+  if (matchSyrk(si) || matchSyr2k(si)) {
+    // the symmetric updates are dense, sparse operands go to spmm.
+    if (!getStorageFormat(si.A).empty() ||
+        (!si.B.empty() && !getStorageFormat(si.B).empty()))
+      return false;
+    emitSyrk(si);
+    return true;
+  }
+  return false;
+}
+
+// check if we are dealing with a batched matmul.
+bool Emitter::matchBatchedMatMul(BatchedMatMulInfo &bmi) {
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (comprehension_.whereClauses().size())
+    return false;
+
+  Tensor a, b;
+  if (!matchProduct(comprehension_.rhs(), a, b, bmi.alpha))
+    return false;
+  auto C = comprehension_.ident().name();
+  if ((C == a.name_) || (C == b.name_))
+    return false;
+  std::vector<std::string> indexC;
+  for (const auto &index : comprehension_.indices())
+    indexC.push_back(index.name());
+
+  // batch indices are in all the operands, everything else
+  // must be a plain matmul.
+  std::vector<std::string> batch, restA, restB, restC;
+  for (const auto &index : indexC) {
+    if (find(index, a.indices_) && find(index, b.indices_))
+      batch.push_back(index);
+    else
+      restC.push_back(index);
+  }
+  if (batch.empty())
+    return false;
+  for (const auto &index : a.indices_)
+    if (!find(index, batch))
+      restA.push_back(index);
+  for (const auto &index : b.indices_)
+    if (!find(index, batch))
+      restB.push_back(index);
+  if (restA.size() != 2 || restB.size() != 2 || restC.size() != 2)
+    return false;
+
+  auto m = restC[0];
+  auto n = restC[1];
+  if (!find(m, restA) || find(m, restB) || !find(n, restB) ||
+      find(n, restA))
+    return false;
+  auto k = (restA[0] == m) ? restA[1] : restA[0];
+  if (!find(k, restB) || find(k, restC))
+    return false;
+
+  for (const auto &index : batch) {
+    bmi.batchDimsA.push_back(getPosition(a.indices_, index));
+    bmi.batchDimsB.push_back(getPosition(b.indices_, index));
+    bmi.batchDimsC.push_back(getPosition(indexC, index));
+  }
+  bmi.A = a.name_;
+  bmi.B = b.name_;
+  bmi.C = C;
+  bmi.transa = (restA[0] == m) ? Trans::N : Trans::T;
+  bmi.transb = (restB[0] == k) ? Trans::N : Trans::T;
+  bmi.beta = "1";
+  return true;
+}
+
+void Emitter::emitBatchedMatMul(const BatchedMatMulInfo &bmi) {
+  os.indent(2) << "batchedMatmulBuilder<"
+               << "StrExpr<\"" << toString(bmi.transa) << "\">, "
+               << "StrExpr<\"" << toString(bmi.transb) << "\">, "
+               << "Batch<" << bmi.batchDimsC.size() << ">, "
+               << "StrExpr<\"{" << toString(bmi.batchDimsA) << ", "
+               << toString(bmi.batchDimsB) << ", "
+               << toString(bmi.batchDimsC) << "}\">, "
+               << "Constant<\"" << bmi.alpha << "\">, "
+               << "Constant<\"" << bmi.beta << "\">, "
+               << "Inputs<["
+               << "\"" << bmi.A << "\""
+               << ","
+               << "\"" << bmi.B << "\""
+               << "]>, Outputs<["
+               << "\"" << bmi.C << "\""
+               << "]>";
+  emitLoopDims(bmi.dims);
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitBatchedMatMul() {
+  BatchedMatMulInfo bmi;
+  if (matchBatchedMatMul(bmi)) {
+    emitBatchedMatMul(bmi);
+    return true;
+  }
+  return false;
+}
+
+// Collect in "coeffs" and "offset" the affine expression "t" of
+// "indices". An index can also be scaled by a scalar parameter (i.e.,
+// s * h), the parameter is then collected in "factors". Return false if
+// "t" is not affine in the indices.
+static bool getAffine(const TreeRef &t, const std::vector<std::string> &indices,
+                      std::map<std::string, int> &coeffs,
+                      std::map<std::string, std::string> &factors,
+                      int &offset, int scale = 1) {
+  switch (t->kind()) {
+  case TK_IDENT:
+    if (!find(Ident(t).name(), indices) || factors.count(Ident(t).name()))
+      return false;
+    coeffs[Ident(t).name()] += scale;
+    return true;
+  case TK_CONST:
+    offset += scale * static_cast<int>(Const(t).value());
+    return true;
+  case '+':
+    return getAffine(t->tree(0), indices, coeffs, factors, offset, scale) &&
+           getAffine(t->tree(1), indices, coeffs, factors, offset, scale);
+  case '-':
+    if (t->trees().size() != 2)
+      return false;
+    return getAffine(t->tree(0), indices, coeffs, factors, offset, scale) &&
+           getAffine(t->tree(1), indices, coeffs, factors, offset, -scale);
+  case '*': {
+    auto lhs = t->tree(0), rhs = t->tree(1);
+    if (lhs->kind() == TK_CONST)
+      return getAffine(rhs, indices, coeffs, factors, offset,
+                       scale * static_cast<int>(Const(lhs).value()));
+    if (rhs->kind() == TK_CONST)
+      return getAffine(lhs, indices, coeffs, factors, offset,
+                       scale * static_cast<int>(Const(rhs).value()));
+    if (lhs->kind() != TK_IDENT || rhs->kind() != TK_IDENT)
+      return false;
+    if (find(Ident(lhs).name(), indices))
+      std::swap(lhs, rhs);
+    auto index = Ident(rhs).name();
+    auto factor = Ident(lhs).name();
+    // a single occurrence of the index, scaled by a parameter only.
+    if (find(factor, indices) || !find(index, indices) || scale != 1 ||
+        coeffs.count(index))
+      return false;
+    coeffs[index] = 1;
+    factors[index] = factor;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// check if we are dealing with a conv. The spatial accesses of the image
+// are in the form stride * out_h + dilation * k_h - padding, the stride and
+// the dilation are constants or scalar parameters.
+bool Emitter::matchConv(ConvInfo &cvi) {
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (!getExtents(comprehension_, cvi.extents))
+    return false;
+
+  auto rhs = comprehension_.rhs();
+  if (rhs->kind() != '*' || rhs->tree(0)->kind() != TK_APPLY ||
+      rhs->tree(1)->kind() != TK_APPLY)
+    return false;
+
+  // the filter is indexed by plain indices only.
+  Tensor filt;
+  auto img = rhs->tree(1);
+  if (!getAccess(rhs->tree(0), filt)) {
+    img = rhs->tree(0);
+    if (!getAccess(rhs->tree(1), filt))
+      return false;
+  }
+  std::vector<std::string> indexOut;
+  for (const auto &index : comprehension_.indices())
+    indexOut.push_back(index.name());
+  cvi.out = comprehension_.ident().name();
+  cvi.filt = filt.name_;
+  cvi.img = Apply(img).name().name();
+  if (cvi.out == cvi.filt || cvi.out == cvi.img)
+    return false;
+
+  // classify the image accesses: batch (n), input channel (c) or spatial.
+  auto indices = indexOut;
+  indices.insert(indices.end(), filt.indices_.begin(), filt.indices_.end());
+  std::string layout;
+  std::vector<std::string> imgIndices;
+  for (const auto &arg : Apply(img).arguments()) {
+    if (arg->kind() == TK_IDENT) {
+      auto index = Ident(arg).name();
+      bool inOut = find(index, indexOut);
+      bool inFilt = find(index, filt.indices_);
+      if (inOut == inFilt)
+        return false;
+      layout += (inOut) ? "N" : "C";
+      cvi.roles[index] = (inOut) ? 'N' : 'C';
+      imgIndices.push_back(index);
+      continue;
+    }
+    std::map<std::string, int> coeffs;
+    std::map<std::string, std::string> factors;
+    int offset = 0;
+    if (!getAffine(arg, indices, coeffs, factors, offset))
+      return false;
+    std::string outIndex, filtIndex;
+    for (const auto &coeff : coeffs) {
+      if (coeff.second == 0)
+        continue;
+      if (coeff.second < 0)
+        return false;
+      bool inOut = find(coeff.first, indexOut);
+      bool inFilt = find(coeff.first, filt.indices_);
+      if (inOut && !inFilt && outIndex.empty())
+        outIndex = coeff.first;
+      else if (inFilt && !inOut && filtIndex.empty())
+        filtIndex = coeff.first;
+      else
+        return false;
+    }
+    if (outIndex.empty() || filtIndex.empty())
+      return false;
+    layout += (cvi.strides.empty()) ? "H" : "W";
+    cvi.roles[outIndex] = (cvi.strides.empty()) ? 'P' : 'Q';
+    cvi.roles[filtIndex] = (cvi.strides.empty()) ? 'R' : 'S';
+    imgIndices.push_back(outIndex);
+    imgIndices.push_back(filtIndex);
+    auto getFactor = [&](const std::string &index) {
+      return factors.count(index) ? factors.at(index)
+                                  : std::to_string(coeffs.at(index));
+    };
+    cvi.strides.push_back(getFactor(outIndex));
+    cvi.dilations.push_back(getFactor(filtIndex));
+    cvi.paddings.push_back(-offset);
+  }
+  if (cvi.strides.size() != 2)
+    return false;
+
+  // all the indices of the output and the filter must be used: the output
+  // channel is the only index not in the image.
+  for (const auto &index : indexOut) {
+    if (find(index, imgIndices))
+      continue;
+    if (!find(index, filt.indices_) || cvi.roles.count(index))
+      return false;
+    cvi.roles[index] = 'K';
+  }
+  for (const auto &index : filt.indices_)
+    if (!find(index, imgIndices) && !find(index, indexOut))
+      return false;
+  cvi.outIndices = indexOut;
+  cvi.filtIndices = filt.indices_;
+
+  if (layout == "NCHW" || layout == "NHWC" || layout == "CHW" ||
+      layout == "HWC")
+    cvi.layout = layout;
+  else if (layout != "HW")
+    return false;
+  return true;
+}
+
+void Emitter::emitConv(const ConvInfo &cvi) {
+  os.indent(2) << "convBuilder<"
+               << "Inputs<["
+               << "\"" << cvi.filt << "\""
+               << ", "
+               << "\"" << cvi.img << "\""
+               << "]>, Outputs<["
+               << "\"" << cvi.out << "\""
+               << "]>, StrExpr<\"{" << cvi.strides[0] << ", " << cvi.strides[1]
+               << ", " << cvi.dilations[0] << ", " << cvi.dilations[1]
+               << "}\">, StrExpr<\"{" << cvi.paddings[0] << ", "
+               << cvi.paddings[1] << "}\">";
+  if (!cvi.layout.empty())
+    os << ", StrExpr<\"" << cvi.layout << "\">";
+  // scalar strides and dilations are not loops.
+  auto dims = getLoopDims();
+  dims.reduction.erase(std::remove_if(dims.reduction.begin(),
+                                      dims.reduction.end(),
+                                      [&](const std::string &index) {
+                                        return find(index, cvi.strides) ||
+                                               find(index, cvi.dilations);
+                                      }),
+                       dims.reduction.end());
+  emitLoopDims(dims);
+  os << ">,\n";
+  return;
+}
+
+// check if the conv is better lowered as im2col followed by a matmul. The
+// patch buffer holds C*R*S x N*P*Q elements and turns the conv into a single
+// matmul with K = C*R*S. Prefer it when the input channels are too few to
+// fill the vector registers of a direct conv and the patch buffer fits in
+// cache. This requires the extents of all the patch indices.
+bool Emitter::matchIm2col(const ConvInfo &cvi, Im2colInfo &ii) {
+  // the output channel is the only non-patch index and must be the
+  // first or the last dimension of the output and the filter.
+  std::string outChannel;
+  std::vector<std::string> spatial, kernel;
+  for (const auto &index : cvi.outIndices) {
+    if (cvi.roles.at(index) == 'K')
+      outChannel = index;
+    else
+      spatial.push_back(index);
+  }
+  if (outChannel.empty())
+    return false;
+  for (const auto &index : cvi.filtIndices)
+    if (index != outChannel)
+      kernel.push_back(index);
+  bool channelFirst = isConcat(cvi.outIndices, {outChannel}, spatial);
+  if (!channelFirst && !isConcat(cvi.outIndices, spatial, {outChannel}))
+    return false;
+  bool filtChannelFirst = isConcat(cvi.filtIndices, {outChannel}, kernel);
+  if (!filtChannelFirst && !isConcat(cvi.filtIndices, kernel, {outChannel}))
+    return false;
+
+  ii.patchIndices = (channelFirst) ? kernel : spatial;
+  auto &rest = (channelFirst) ? spatial : kernel;
+  ii.patchIndices.insert(ii.patchIndices.end(), rest.begin(), rest.end());
+
+  int64_t channels = 1;
+  int64_t patchSize = 1;
+  for (const auto &index : ii.patchIndices) {
+    if (!cvi.extents.count(index))
+      return false;
+    patchSize *= cvi.extents.at(index);
+    if (cvi.roles.at(index) == 'C')
+      channels *= cvi.extents.at(index);
+    ii.patchLayout += cvi.roles.at(index);
+  }
+  if (channels * target_.elementSize >= 2 * target_.vectorWidth)
+    return false;
+  if (patchSize * target_.elementSize > target_.l2CacheSize)
+    return false;
+
+  ii.conv = cvi;
+  ii.mmi.C = cvi.out;
+  ii.mmi.alpha = "1";
+  ii.mmi.beta = "1";
+  ii.mmi.dimensionsForK = kernel.size();
+  if (channelFirst) {
+    ii.mmi.A = cvi.filt;
+    ii.mmi.transa = (filtChannelFirst) ? Trans::N : Trans::T;
+    ii.mmi.transb = Trans::N;
+    ii.mmi.dimensionsForM = 1;
+    ii.mmi.dimensionsForN = spatial.size();
+  } else {
+    ii.mmi.B = cvi.filt;
+    ii.mmi.transa = Trans::N;
+    ii.mmi.transb = (filtChannelFirst) ? Trans::T : Trans::N;
+    ii.mmi.dimensionsForM = spatial.size();
+    ii.mmi.dimensionsForN = 1;
+  }
+  return true;
+}
+
+void Emitter::emitIm2col(const Im2colInfo &ii) {
+  os.indent(2) << "im2colBuilder<"
+               << "Inputs<["
+               << "\"" << ii.conv.img << "\""
+               << "]>, Outputs<["
+               << "\"" << ii.patch << "\""
+               << "]>, StrExpr<\"{" << ii.conv.strides[0] << ", "
+               << ii.conv.strides[1] << ", " << ii.conv.dilations[0] << ", "
+               << ii.conv.dilations[1] << "}\">, StrExpr<\"{"
+               << ii.conv.paddings[0] << ", " << ii.conv.paddings[1]
+               << "}\">, StrExpr<\""
+               << (ii.conv.layout.empty() ? "HW" : ii.conv.layout)
+               << "\">, StrExpr<\"" << ii.patchLayout << "\">";
+  emitLoopDims({ii.patchIndices, {}});
+  os << ">,\n";
+  emitMatMul(ii.mmi);
+}
+
+// check if the conv can use Winograd: unit-stride 3x3 with input and
+// output channels. F(4x4, 3x3) saves more multiplications but is less
+// accurate and wastes work on partial tiles, use it only when the output
+// extents are multiple of 4.
+bool Emitter::matchWinograd(const ConvInfo &cvi, WinogradInfo &wi) {
+  if (cvi.strides != std::vector<std::string>{"1", "1"} ||
+      cvi.dilations != std::vector<std::string>{"1", "1"})
+    return false;
+  bool hasInputChannel = false;
+  bool hasOutputChannel = false;
+  std::string p, q;
+  for (const auto &role : cvi.roles) {
+    hasInputChannel |= (role.second == 'C');
+    hasOutputChannel |= (role.second == 'K');
+    if (role.second == 'P')
+      p = role.first;
+    if (role.second == 'Q')
+      q = role.first;
+    if ((role.second == 'R' || role.second == 'S') &&
+        (!cvi.extents.count(role.first) || cvi.extents.at(role.first) != 3))
+      return false;
+  }
+  if (!hasInputChannel || !hasOutputChannel)
+    return false;
+
+  bool knownExtents = cvi.extents.count(p) && cvi.extents.count(q);
+  wi.m = (knownExtents && cvi.extents.at(p) % 4 == 0 &&
+          cvi.extents.at(q) % 4 == 0)
+             ? 4
+             : 2;
+  auto getTiles = [&](const std::string &index) {
+    if (!cvi.extents.count(index))
+      return index + "/" + std::to_string(wi.m);
+    return std::to_string((cvi.extents.at(index) + wi.m - 1) / wi.m);
+  };
+  wi.tilesP = getTiles(p);
+  wi.tilesQ = getTiles(q);
+  for (const auto &index : cvi.filtIndices)
+    wi.filtLayout += cvi.roles.at(index);
+  for (const auto &index : cvi.outIndices)
+    wi.outLayout += cvi.roles.at(index);
+  wi.conv = cvi;
+  return true;
+}
+
+void Emitter::emitWinograd(const WinogradInfo &wi) {
+  auto kind = "F(" + std::to_string(wi.m) + "x" + std::to_string(wi.m) +
+              ", 3x3)";
+  // the transforms are maps, the batched matmul reduces the input
+  // channels only.
+  LoopDims inputDims, matmulDims = {wi.conv.outIndices, {}};
+  for (const auto &index : wi.conv.outIndices)
+    if (wi.conv.roles.at(index) != 'K')
+      inputDims.parallel.push_back(index);
+  for (const auto &index : wi.conv.filtIndices)
+    if (wi.conv.roles.at(index) == 'C') {
+      inputDims.parallel.push_back(index);
+      matmulDims.reduction.push_back(index);
+    }
+  // the filter transform depends only on the weights, it can be hoisted
+  // out when they are constant.
+  os.indent(2) << "winogradFilterTransformBuilder<"
+               << "Inputs<["
+               << "\"" << wi.conv.filt << "\""
+               << "]>, Outputs<["
+               << "\"" << wi.filt << "\""
+               << "]>, StrExpr<\"" << kind << "\">, StrExpr<\""
+               << wi.filtLayout << "\">, Hoistable<1>";
+  emitLoopDims({wi.conv.filtIndices, {}});
+  os << ">,\n";
+  os.indent(2) << "winogradInputTransformBuilder<"
+               << "Inputs<["
+               << "\"" << wi.conv.img << "\""
+               << "]>, Outputs<["
+               << "\"" << wi.img << "\""
+               << "]>, StrExpr<\"" << kind << "\">, StrExpr<\"{"
+               << wi.conv.paddings[0] << ", " << wi.conv.paddings[1]
+               << "}\">, StrExpr<\"" << wi.conv.layout << "\">";
+  emitLoopDims(inputDims);
+  os << ">,\n";
+  BatchedMatMulInfo bmi;
+  bmi.A = wi.filt;
+  bmi.B = wi.img;
+  bmi.C = wi.out;
+  bmi.transa = Trans::N;
+  bmi.transb = Trans::N;
+  bmi.alpha = "1";
+  bmi.beta = "1";
+  bmi.batchDimsA = {0};
+  bmi.batchDimsB = {0};
+  bmi.batchDimsC = {0};
+  bmi.dims = matmulDims;
+  emitBatchedMatMul(bmi);
+  os.indent(2) << "winogradOutputTransformBuilder<"
+               << "Inputs<["
+               << "\"" << wi.out << "\""
+               << "]>, Outputs<["
+               << "\"" << wi.conv.out << "\""
+               << "]>, StrExpr<\"" << kind << "\">, StrExpr<\""
+               << wi.outLayout << "\">";
+  emitLoopDims({wi.conv.outIndices, {}});
+  os << ">,\n";
+}
+
+bool Emitter::matchAndEmitConv() {
+  ConvInfo cvi;
+  if (!matchConv(cvi))
+    return false;
+  Im2colInfo ii;
+  WinogradInfo wi;
+  bool useIm2col = matchIm2col(cvi, ii);
+  if (!useIm2col && matchWinograd(cvi, wi)) {
+    // U(xi, k, c), V(xi, c, tiles) and M(xi, k, tiles) with xi the
+    // (m + 2)^2 points of a tile.
+    std::string points = std::to_string((wi.m + 2) * (wi.m + 2));
+    SymbolicSize filtSize = {points}, imgSize = {points}, outSize = {points};
+    for (const auto &role : cvi.roles) {
+      if (role.second == 'K' || role.second == 'C')
+        filtSize.push_back(role.first);
+      if (role.second == 'K' || role.second == 'N')
+        outSize.push_back(role.first);
+      if (role.second == 'C' || role.second == 'N')
+        imgSize.push_back(role.first);
+    }
+    for (auto size : {&imgSize, &outSize}) {
+      size->push_back(wi.tilesP);
+      size->push_back(wi.tilesQ);
+    }
+    for (auto size : {&filtSize, &imgSize, &outSize})
+      std::sort(size->begin(), size->end());
+    wi.filt = symbolTable_.getNextVariable(filtSize);
+    wi.img = symbolTable_.getNextVariable(imgSize);
+    wi.out = symbolTable_.getNextVariable(outSize);
+    emitWinograd(wi);
+    for (const auto &tmp : {wi.filt, wi.img, wi.out})
+      symbolTable_.releaseBuffer(tmp);
+    return true;
+  }
+  if (!useIm2col) {
+    emitConv(cvi);
+    return true;
+  }
+  auto patchSize = ii.patchIndices;
+  std::sort(patchSize.begin(), patchSize.end());
+  ii.patch = symbolTable_.getNextVariable(patchSize);
+  if (ii.mmi.A.empty())
+    ii.mmi.A = ii.patch;
+  else
+    ii.mmi.B = ii.patch;
+  emitIm2col(ii);
+  symbolTable_.releaseBuffer(ii.patch);
+  return true;
+}
+
+// default extent for the indices without range constraints.
+static constexpr int64_t kDefaultExtent = 100;
+// up to this number of operands all the contraction orders are evaluated,
+// above the path is built greedily.
+static constexpr size_t kExhaustiveLimit = 8;
+
+// Flatten a product of accesses.
+static bool getProductOperands(const TreeRef &t,
+                               std::vector<Tensor> &operands) {
+  if (t->kind() == '*')
+    return getProductOperands(t->tree(0), operands) &&
+           getProductOperands(t->tree(1), operands);
+  Tensor tensor;
+  if (!getAccess(t, tensor))
+    return false;
+  operands.push_back(tensor);
+  return true;
+}
+
+namespace {
+
+// Search the order of the binary contractions minimizing the flops. A set
+// of inputs is represented as a bitmask. Each binary contraction must be a
+// plain matmul: no batch indices and non-empty M, N and K.
+class ContractionPathFinder {
+public:
+  ContractionPathFinder(const ContractionInfo &ci, double maxSize)
+      : ci_(ci), maxSize_(maxSize),
+        full_((uint64_t(1) << ci.operands.size()) - 1) {}
+
+  bool findPath(std::vector<std::pair<size_t, size_t>> &path) {
+    std::vector<std::pair<uint64_t, uint64_t>> steps;
+    bool found = (ci_.operands.size() <= kExhaustiveLimit)
+                     ? findExhaustive(steps)
+                     : findGreedy(steps);
+    if (!found)
+      return false;
+    // operand ids: inputs first then the result of each step.
+    std::map<uint64_t, size_t> ids;
+    for (size_t i = 0; i < ci_.operands.size(); i++)
+      ids[uint64_t(1) << i] = i;
+    for (size_t i = 0; i < steps.size(); i++) {
+      path.push_back({ids[steps[i].first], ids[steps[i].second]});
+      ids[steps[i].first | steps[i].second] = ci_.operands.size() + i;
+    }
+    return true;
+  }
+
+private:
+  // indices of the contraction of "mask" still needed by the output
+  // or by the other inputs.
+  std::set<std::string> getIndices(uint64_t mask) const {
+    std::set<std::string> needed(ci_.outIndices.begin(),
+                                 ci_.outIndices.end());
+    for (size_t i = 0; i < ci_.operands.size(); i++)
+      if (!(mask & (uint64_t(1) << i)))
+        needed.insert(ci_.operands[i].indices_.begin(),
+                      ci_.operands[i].indices_.end());
+    std::set<std::string> res;
+    for (size_t i = 0; i < ci_.operands.size(); i++)
+      if (mask & (uint64_t(1) << i))
+        for (const auto &index : ci_.operands[i].indices_)
+          if (needed.count(index))
+            res.insert(index);
+    return res;
+  }
+
+  double getExtent(const std::string &index) const {
+    auto it = ci_.extents.find(index);
+    return (it == ci_.extents.end()) ? kDefaultExtent : it->second;
+  }
+
+  double getSize(uint64_t mask) const {
+    double size = 1;
+    for (const auto &index : getIndices(mask))
+      size *= getExtent(index);
+    return size;
+  }
+
+  double getFlops(uint64_t a, uint64_t b) const {
+    auto indices = getIndices(a);
+    auto indicesB = getIndices(b);
+    indices.insert(indicesB.begin(), indicesB.end());
+    double flops = 1;
+    for (const auto &index : indices)
+      flops *= getExtent(index);
+    return flops;
+  }
+
+  bool isValid(uint64_t a, uint64_t b) const {
+    auto indicesA = getIndices(a);
+    auto indicesB = getIndices(b);
+    auto res = getIndices(a | b);
+    bool hasM = false, hasN = false, hasK = false;
+    for (const auto &index : indicesA) {
+      bool inB = indicesB.count(index);
+      if (inB && res.count(index))
+        return false;
+      hasK |= inB;
+      hasM |= !inB;
+    }
+    for (const auto &index : indicesB)
+      hasN |= !indicesA.count(index);
+    if (!hasM || !hasN || !hasK)
+      return false;
+    return ((a | b) == full_) || (getSize(a | b) <= maxSize_);
+  }
+
+  bool findExhaustive(std::vector<std::pair<uint64_t, uint64_t>> &steps) {
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> cost(full_ + 1, inf);
+    std::vector<std::pair<uint64_t, uint64_t>> split(full_ + 1);
+    for (uint64_t mask = 1; mask <= full_; mask++) {
+      if ((mask & (mask - 1)) == 0) {
+        cost[mask] = 0;
+        continue;
+      }
+      for (uint64_t a = (mask - 1) & mask; a > 0; a = (a - 1) & mask) {
+        uint64_t b = mask ^ a;
+        if (a > b || cost[a] == inf || cost[b] == inf || !isValid(a, b))
+          continue;
+        double c = cost[a] + cost[b] + getFlops(a, b);
+        if (c < cost[mask]) {
+          cost[mask] = c;
+          split[mask] = {a, b};
+        }
+      }
+    }
+    if (cost[full_] == inf)
+      return false;
+    std::function<void(uint64_t)> walk = [&](uint64_t mask) {
+      if ((mask & (mask - 1)) == 0)
+        return;
+      walk(split[mask].first);
+      walk(split[mask].second);
+      steps.push_back(split[mask]);
+    };
+    walk(full_);
+    return true;
+  }
+
+  bool findGreedy(std::vector<std::pair<uint64_t, uint64_t>> &steps) {
+    std::vector<uint64_t> live;
+    for (size_t i = 0; i < ci_.operands.size(); i++)
+      live.push_back(uint64_t(1) << i);
+    while (live.size() > 1) {
+      bool found = false;
+      size_t bestI = 0, bestJ = 0;
+      std::pair<double, double> best;
+      for (size_t i = 0; i < live.size(); i++)
+        for (size_t j = i + 1; j < live.size(); j++) {
+          if (!isValid(live[i], live[j]))
+            continue;
+          std::pair<double, double> c = {getFlops(live[i], live[j]),
+                                         getSize(live[i] | live[j])};
+          if (!found || c < best) {
+            found = true;
+            best = c;
+            bestI = i;
+            bestJ = j;
+          }
+        }
+      if (!found)
+        return false;
+      steps.push_back({live[bestI], live[bestJ]});
+      live[bestI] |= live[bestJ];
+      live.erase(live.begin() + bestJ);
+    }
+    return true;
+  }
+
+  const ContractionInfo &ci_;
+  double maxSize_;
+  uint64_t full_;
+};
+
+} // end namespace
+
+// check if we are dealing with a contraction of more than two
+// operands and find the order of the binary contractions.
+bool Emitter::matchContraction(ContractionInfo &ci) {
+  if (comprehension_.assignment()->kind() != TK_PLUS_EQ)
+    return false;
+  if (!getExtents(comprehension_, ci.extents))
+    return false;
+  if (!getProductOperands(comprehension_.rhs(), ci.operands))
+    return false;
+  if (ci.operands.size() < 3 || ci.operands.size() > 63)
+    return false;
+
+  ci.out = comprehension_.ident().name();
+  std::map<std::string, int> uses;
+  for (const auto &index : comprehension_.indices()) {
+    if (find(index.name(), ci.outIndices))
+      return false;
+    ci.outIndices.push_back(index.name());
+    uses[index.name()]++;
+  }
+  for (const auto &operand : ci.operands) {
+    if (operand.name_ == ci.out)
+      return false;
+    for (const auto &index : operand.indices_)
+      uses[index]++;
+  }
+  // reductions over a single operand and broadcasts are not supported.
+  for (const auto &use : uses)
+    if (use.second < 2)
+      return false;
+
+  ContractionPathFinder finder(ci,
+                               target_.memoryLimit / target_.elementSize);
+  return finder.findPath(ci.path);
+}
+
+void Emitter::emitContraction(ContractionInfo &ci) {
+  auto inputs = ci.operands.size();
+  std::vector<bool> live(inputs, true);
+
+  // transpose "t" in a temporary with "layout".
+  auto transpose = [&](const Tensor &t,
+                       const std::vector<std::string> &layout) {
+    auto size = layout;
+    std::sort(size.begin(), size.end());
+    auto tmp = symbolTable_.getNextVariable(size);
+    emitTranspose(
+        {tmp, t.name_, getOrdering(t.indices_, layout), {}, {layout, {}}});
+    return Tensor{tmp, layout, {}};
+  };
+
+  for (size_t i = 0; i < ci.path.size(); i++) {
+    auto lhs = ci.operands[ci.path[i].first];
+    auto rhs = ci.operands[ci.path[i].second];
+    live[ci.path[i].first] = false;
+    live[ci.path[i].second] = false;
+    bool isLast = (i == ci.path.size() - 1);
+
+    std::vector<std::string> needed = ci.outIndices;
+    for (size_t j = 0; j < live.size(); j++)
+      if (live[j])
+        needed.insert(needed.end(), ci.operands[j].indices_.begin(),
+                      ci.operands[j].indices_.end());
+    std::vector<std::string> m, n;
+    for (const auto &index : lhs.indices_)
+      if (find(index, needed) && !find(index, rhs.indices_))
+        m.push_back(index);
+    for (const auto &index : rhs.indices_)
+      if (find(index, needed) && !find(index, lhs.indices_))
+        n.push_back(index);
+
+    // the output fixes the order of M and N, swap the operands if
+    // N comes first. Otherwise go through a transposed temporary.
+    Tensor res{ci.out, ci.outIndices, {}};
+    bool ttgt = false;
+    if (isLast) {
+      auto outM = std::vector<std::string>(
+          ci.outIndices.begin(), ci.outIndices.begin() + m.size());
+      auto outN = std::vector<std::string>(
+          ci.outIndices.begin(), ci.outIndices.begin() + n.size());
+      if (find(m, outM)) {
+        m = outM;
+        n.assign(ci.outIndices.begin() + m.size(), ci.outIndices.end());
+      } else if (find(n, outN)) {
+        std::swap(lhs, rhs);
+        std::swap(m, n);
+        m = outN;
+        n.assign(ci.outIndices.begin() + m.size(), ci.outIndices.end());
+      } else {
+        ttgt = true;
+      }
+    }
+    if (!isLast || ttgt) {
+      auto layout = m;
+      layout.insert(layout.end(), n.begin(), n.end());
+      if (ttgt) {
+        res = transpose(res, layout);
+      } else {
+        auto size = layout;
+        std::sort(size.begin(), size.end());
+        res = Tensor{symbolTable_.getNextVariable(size), layout, {}};
+      }
+    }
+
+    // pick the order of K requiring less transposes.
+    std::vector<std::string> kLhs, kRhs;
+    for (const auto &index : lhs.indices_)
+      if (find(index, rhs.indices_))
+        kLhs.push_back(index);
+    for (const auto &index : rhs.indices_)
+      if (find(index, lhs.indices_))
+        kRhs.push_back(index);
+    auto getTransposes = [&](const std::vector<std::string> &k) {
+      int count = 0;
+      if (!isConcat(lhs.indices_, m, k) && !isConcat(lhs.indices_, k, m))
+        count++;
+      if (!isConcat(rhs.indices_, k, n) && !isConcat(rhs.indices_, n, k))
+        count++;
+      return count;
+    };
+    auto k = (getTransposes(kRhs) < getTransposes(kLhs)) ? kRhs : kLhs;
+
+    std::vector<std::string> transposed;
+    if (!isConcat(lhs.indices_, m, k) && !isConcat(lhs.indices_, k, m)) {
+      auto layout = m;
+      layout.insert(layout.end(), k.begin(), k.end());
+      lhs = transpose(lhs, layout);
+      transposed.push_back(lhs.name_);
+    }
+    if (!isConcat(rhs.indices_, k, n) && !isConcat(rhs.indices_, n, k)) {
+      auto layout = k;
+      layout.insert(layout.end(), n.begin(), n.end());
+      rhs = transpose(rhs, layout);
+      transposed.push_back(rhs.name_);
+    }
+
+    MatMulInfo mmi;
+    mmi.A = lhs.name_;
+    mmi.B = rhs.name_;
+    mmi.C = res.name_;
+    mmi.transa = isConcat(lhs.indices_, m, k) ? Trans::N : Trans::T;
+    mmi.transb = isConcat(rhs.indices_, k, n) ? Trans::N : Trans::T;
+    mmi.alpha = "1";
+    // intermediates are not initialized.
+    mmi.beta = (isLast) ? "1" : "0";
+    mmi.dimensionsForM = m.size();
+    mmi.dimensionsForN = n.size();
+    mmi.dimensionsForK = k.size();
+    mmi.dims = {res.indices_, k};
+    emitMatMul(mmi);
+
+    for (const auto &tmp : transposed)
+      symbolTable_.releaseBuffer(tmp);
+    for (auto id : {ci.path[i].first, ci.path[i].second})
+      if (id >= inputs)
+        symbolTable_.releaseBuffer(ci.operands[id].name_);
+    if (ttgt) {
+      emitTranspose({ci.out, res.name_,
+                     getOrdering(res.indices_, ci.outIndices), {},
+                     {ci.outIndices, {}}});
+      symbolTable_.releaseBuffer(res.name_);
+    }
+    if (!isLast) {
+      ci.operands.push_back(res);
+      live.push_back(true);
+    }
+  }
+}
+
+bool Emitter::matchAndEmitContraction() {
+  ContractionInfo ci;
+  if (matchContraction(ci)) {
+    emitContraction(ci);
+    return true;
+  }
+  return false;
+}
+
+void Emitter::emitHow() {
+
+  if (matchAndEmitSyrk())
+    return;
+  if (matchAndEmitMatMul())
+    return;
+  if (matchAndEmitQuantizedMatMul())
+    return;
+  if (matchAndEmitSemiringMatMul())
+    return;
+  if (matchAndEmitBatchedMatMul())
+    return;
+  if (matchAndEmitMatVec())
+    return;
+  if (matchAndEmitGer())
+    return;
+  if (matchAndEmitDot())
+    return;
+  if (matchAndEmitAxpy())
+    return;
+  if (matchAndEmitScal())
+    return;
+
+  if (matchAndEmitReshape())
+    return;
+  if (matchAndEmitTranspose())
+    return;
+  if (matchAndEmitElementwise())
+    return;
+
+  if (matchAndEmitConv())
+    return;
+  if (matchAndEmitContraction())
+    return;
 
   throw ErrorReport(comprehension_) << "unknown builder";
 }
 
-static void recursivelyEmitRhs(const TreeRef &t, llvm::raw_ostream &os) {
+static bool isAdditive(const TreeRef &t) {
+  return t->kind() == '+' || t->kind() == '-';
+}
+
+// Emit "t" replacing the subtree "acc" (if any) with %acc.
+static void recursivelyEmitRhs(const TreeRef &t, llvm::raw_ostream &os,
+                               const TreeRef &acc) {
+  if (t == acc) {
+    os << "%acc";
+    return;
+  }
+  auto emitOperand = [&](const TreeRef &operand, bool parens) {
+    if (parens)
+      os << "(";
+    recursivelyEmitRhs(operand, os, acc);
+    if (parens)
+      os << ")";
+  };
   switch (t->kind()) {
   case '+': {
-    recursivelyEmitRhs(t->trees().at(0), os);
+    emitOperand(t->trees().at(0), false);
     os << " + ";
-    recursivelyEmitRhs(t->trees().at(1), os);
+    emitOperand(t->trees().at(1), false);
+    return;
+  }
+  case '-': {
+    if (t->trees().size() == 1) {
+      os << "-";
+      emitOperand(t->trees().at(0), isAdditive(t->trees().at(0)));
+      return;
+    }
+    emitOperand(t->trees().at(0), false);
+    os << " - ";
+    emitOperand(t->trees().at(1), isAdditive(t->trees().at(1)));
     return;
   }
   case '*': {
-    recursivelyEmitRhs(t->trees().at(0), os);
+    emitOperand(t->trees().at(0), isAdditive(t->trees().at(0)));
     os << " * ";
-    recursivelyEmitRhs(t->trees().at(1), os);
+    emitOperand(t->trees().at(1), isAdditive(t->trees().at(1)));
+    return;
+  }
+  case '/': {
+    emitOperand(t->trees().at(0), isAdditive(t->trees().at(0)));
+    os << " / ";
+    auto kind = t->trees().at(1)->kind();
+    emitOperand(t->trees().at(1), kind == '+' || kind == '-' || kind == '*' ||
+                                      kind == '/');
+    return;
+  }
+  case TK_CAST: {
+    os << kindToString(Cast(t).type()->kind()) << "(";
+    emitOperand(Cast(t).value(), false);
+    os << ")";
+    return;
+  }
+  case TK_AND:
+  case TK_OR: {
+    auto isOr = [](const TreeRef &operand) { return operand->kind() == TK_OR; };
+    bool isAnd = t->kind() == TK_AND;
+    emitOperand(t->trees().at(0), isAnd && isOr(t->trees().at(0)));
+    os << (isAnd ? " && " : " || ");
+    emitOperand(t->trees().at(1), isAnd && isOr(t->trees().at(1)));
+    return;
+  }
+  case '<':
+  case '>':
+  case TK_LE:
+  case TK_GE:
+  case TK_EQ:
+  case TK_NE: {
+    emitOperand(t->trees().at(0), false);
+    os << " " << kindToToken(t->kind()) << " ";
+    emitOperand(t->trees().at(1), false);
+    return;
+  }
+  case TK_MIN:
+  case TK_MAX: {
+    os << ((t->kind() == TK_MIN) ? "min(" : "max(");
+    emitOperand(t->trees().at(0), false);
+    os << ", ";
+    emitOperand(t->trees().at(1), false);
+    os << ")";
+    return;
+  }
+  case TK_CONST: {
+    auto value = Const(t).value();
+    if (value == static_cast<int64_t>(value))
+      os << static_cast<int64_t>(value);
+    else
+      os << value;
     return;
   }
   case TK_APPLY: {
@@ -907,19 +3198,9 @@ static void recursivelyEmitRhs(const TreeRef &t, llvm::raw_ostream &os) {
     os << name << "(";
     auto indices = Apply(t).arguments();
     for (size_t i = 0; i < indices.size(); i++) {
-      if (indices[i]->kind() != TK_IDENT) {
-        if (i == indices.size() - 1)
-          recursivelyEmitRhs(indices[i], os);
-        else {
-          recursivelyEmitRhs(indices[i], os);
-          os << ", ";
-        }
-      } else {
-        if (i == indices.size() - 1)
-          os << Ident(indices[i]).name();
-        else
-          os << Ident(indices[i]).name() << ", ";
-      }
+      if (i != 0)
+        os << ", ";
+      recursivelyEmitRhs(indices[i], os, acc);
     }
     os << ")";
     return;
@@ -929,16 +3210,19 @@ static void recursivelyEmitRhs(const TreeRef &t, llvm::raw_ostream &os) {
     return;
   }
   }
-  throw ErrorReport(t) << "expect only TK_APPLY, TK_IDENT, '+' and '*' but "
-                          "got"
+  throw ErrorReport(t) << "expect only TK_APPLY, TK_IDENT, TK_CONST, '+', '-', "
+                          "'*', '/', '&&', '||', comparisons, casts, min and "
+                          "max but got"
                        << t->kind() << "\n";
 }
 
 void Emitter::emitWhat() {
   os << "def Tactic : Tactics<";
-  if (comprehension_.whereClauses().size())
-    throw ErrorReport(comprehension_)
-        << "what part cannot have 'where' clauses";
+  // range constraints only carry extents.
+  for (const auto &where : comprehension_.whereClauses())
+    if (where->kind() != TK_RANGE_CONSTRAINT)
+      throw ErrorReport(comprehension_)
+          << "what part cannot have 'where' clauses";
   auto lhs = comprehension_.ident().name();
   auto lhsIndexes = comprehension_.indices();
   auto assignment = comprehension_.assignment();
@@ -958,6 +3242,15 @@ void Emitter::emitWhat() {
   case TK_PLUS_EQ:
     os << " += ";
     break;
+  case TK_TIMES_EQ:
+    os << " *= ";
+    break;
+  case TK_MIN_EQ:
+    os << " min= ";
+    break;
+  case TK_MAX_EQ:
+    os << " max= ";
+    break;
   default:
     throw ErrorReport(assignment) << "assignment not available yet";
   }
@@ -966,3 +3259,571 @@ void Emitter::emitWhat() {
   recursivelyEmitRhs(rhs, os);
   os << "\", \n";
 }
+
+// Rename the indices of the accesses in "t".
+static TreeRef renameIndices(const TreeRef &t,
+                             const std::map<std::string, TreeRef> &names) {
+  if (t->kind() == TK_APPLY &&
+      !builtin_functions.count(Apply(t).name().name())) {
+    TreeList args;
+    for (const auto &arg : Apply(t).arguments()) {
+      auto it = (arg->kind() == TK_IDENT) ? names.find(Ident(arg).name())
+                                          : names.end();
+      args.push_back((it == names.end()) ? arg : it->second);
+    }
+    return Apply::create(t->range(), t->tree(0),
+                         List::create(t->tree(1)->range(), std::move(args)));
+  }
+  return t->map([&](TreeRef c) { return renameIndices(c, names); });
+}
+
+// Replace the accesses to "producer" in "t" with its rhs.
+static TreeRef inlineProducer(const TreeRef &t, Comprehension producer) {
+  if (t->kind() == TK_APPLY &&
+      Apply(t).name().name() == producer.ident().name()) {
+    std::map<std::string, TreeRef> names;
+    auto args = Apply(t).arguments();
+    for (size_t i = 0; i < producer.indices().size(); i++)
+      names[producer.indices()[i].name()] = args[i];
+    return renameIndices(producer.rhs(), names);
+  }
+  return t->map([&](TreeRef c) { return inlineProducer(c, producer); });
+}
+
+// Fuse producer-consumer chains of elementwise statements over the same
+// indices. The producer must be a temporary written once and read only by
+// the consumer. Its inputs must not be written in between.
+static std::vector<Comprehension>
+fuseElementwise(std::vector<Comprehension> stmts,
+                const std::set<std::string> &operands) {
+  auto getIndices = [](Comprehension c) {
+    std::set<std::string> res;
+    for (const auto &index : c.indices())
+      res.insert(index.name());
+    return res;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t p = 1; p < stmts.size() && !changed; p++) {
+      auto producer = stmts[p];
+      auto name = producer.ident().name();
+      if (!isElementwise(producer) || operands.count(name))
+        continue;
+      auto inputs = getTensors(producer);
+      inputs.erase(inputs.begin());
+      size_t consumer = 0;
+      bool fusable = true;
+      for (size_t i = 1; i < stmts.size() && fusable; i++) {
+        if (i == p)
+          continue;
+        auto tensors = getTensors(stmts[i]);
+        bool reads = find(name, std::vector<std::string>(tensors.begin() + 1,
+                                                         tensors.end()));
+        if (tensors[0] == name || (reads && (i < p || consumer)))
+          fusable = false;
+        else if (reads)
+          consumer = i;
+        // the inputs of the producer are not written before the consumer.
+        if (i > p && (!consumer || consumer == i) &&
+            find(tensors[0], inputs))
+          fusable = false;
+      }
+      if (!fusable || !consumer || !isElementwise(stmts[consumer]) ||
+          getIndices(stmts[consumer]) != getIndices(producer))
+        continue;
+      auto c = stmts[consumer];
+      stmts[consumer] = Comprehension(Comprehension::create(
+          c.range(), c.ident(), c.indices(), c.assignment(),
+          inlineProducer(c.rhs(), producer), c.whereClauses(), c.equivalent(),
+          c.reductionVariables()));
+      stmts.erase(stmts.begin() + p);
+      changed = true;
+    }
+  }
+  return stmts;
+}
+
+// Return a copy of "t" where the indices of the accesses to "name" are
+// reordered by "layout": dimension i of the new layout is dimension
+// layout[i] of the old one.
+static TreeRef permuteAccesses(const TreeRef &t, const std::string &name,
+                               const std::vector<size_t> &layout) {
+  auto permute = [&](const TreeRef &list) {
+    TreeList args;
+    for (auto dim : layout)
+      args.push_back(list->trees()[dim]);
+    return List::create(list->range(), std::move(args));
+  };
+  switch (t->kind()) {
+  case TK_COMPREHENSION: {
+    auto c = Comprehension(t);
+    auto indices = (c.ident().name() == name) ? permute(c.indices().tree())
+                                              : c.indices().tree();
+    return Comprehension::create(c.range(), c.ident(), indices,
+                                 c.assignment(),
+                                 permuteAccesses(c.rhs(), name, layout),
+                                 c.whereClauses(), c.equivalent(),
+                                 c.reductionVariables());
+  }
+  case TK_APPLY:
+    if (Apply(t).name().name() == name)
+      return Apply::create(t->range(), t->tree(0), permute(t->tree(1)));
+    return t;
+  default:
+    return t->map([&](TreeRef c) { return permuteAccesses(c, name, layout); });
+  }
+}
+
+// up to this number of layout assignments all of them are evaluated, above
+// the layout of each temporary is improved in turn.
+static constexpr size_t kExhaustiveLayouts = 256;
+// the temporaries with more dimensions keep the layout of the tactic.
+static constexpr size_t kMaxLayoutRank = 4;
+
+// Choose the dimension order of each temporary of the how. The orders are
+// free as long as all the accesses to a temporary agree, the assignment
+// moving the fewest bytes through transposes is kept. A statement that
+// cannot be lowered with a given assignment makes it invalid.
+std::vector<Comprehension>
+TacticEmitter::assignLayouts(const std::vector<Comprehension> &stmts,
+                             const std::set<std::string> &operands) {
+  // temporary -> rank, -1 if the accesses do not agree.
+  std::map<std::string, int> ranks;
+  for (size_t i = 1; i < stmts.size(); i++) {
+    if (!operands.count(stmts[i].ident().name()))
+      ranks.insert({stmts[i].ident().name(), stmts[i].indices().size()});
+    applyRecursive(stmts[i], [&](const TreeRef &t) {
+      if (t->kind() != TK_APPLY)
+        return;
+      auto it = ranks.find(Apply(t).name().name());
+      if (it != ranks.end() && it->second != (int)Apply(t).arguments().size())
+        it->second = -1;
+    });
+  }
+  std::vector<std::string> temps;
+  std::vector<std::vector<std::vector<size_t>>> layouts;
+  size_t assignments = 1;
+  for (const auto &it : ranks) {
+    if (it.second < 2 || it.second > (int)kMaxLayoutRank)
+      continue;
+    std::vector<size_t> layout(it.second);
+    for (size_t i = 0; i < layout.size(); i++)
+      layout[i] = i;
+    temps.push_back(it.first);
+    layouts.push_back({});
+    do
+      layouts.back().push_back(layout);
+    while (std::next_permutation(layout.begin(), layout.end()));
+    assignments *= layouts.back().size();
+  }
+  if (temps.empty())
+    return stmts;
+
+  std::map<std::string, int64_t> extents;
+  getExtents(stmts[0], extents);
+  auto apply = [&](const std::vector<size_t> &choice) {
+    std::vector<Comprehension> res;
+    for (const auto &stmt : stmts) {
+      TreeRef t = stmt;
+      for (size_t i = 0; i < temps.size(); i++)
+        t = permuteAccesses(t, temps[i], layouts[i][choice[i]]);
+      res.push_back(Comprehension(t));
+    }
+    return res;
+  };
+  // bytes read and written by the transposes, -1 if invalid.
+  auto getCost = [&](const std::vector<size_t> &choice) -> int64_t {
+    auto symbolTable = Emitter::symbolTable_;
+    Emitter::transposed_.clear();
+    int64_t cost = 0;
+    try {
+      llvm::raw_null_ostream nos;
+      emitStatements(apply(choice), operands, nos);
+      for (const auto &size : Emitter::transposed_) {
+        int64_t elements = 1;
+        for (const auto &index : size)
+          elements *= (extents.count(index)) ? extents[index] : kDefaultExtent;
+        cost += 2 * elements * target_.elementSize;
+      }
+    } catch (ErrorReport &) {
+      cost = -1;
+    }
+    Emitter::symbolTable_ = symbolTable;
+    Emitter::transposed_.clear();
+    return cost;
+  };
+
+  std::vector<size_t> best(temps.size(), 0);
+  int64_t bestCost = getCost(best);
+  if (bestCost <= 0)
+    return stmts;
+  auto update = [&](const std::vector<size_t> &choice) {
+    auto cost = getCost(choice);
+    if (cost < 0 || cost >= bestCost)
+      return false;
+    best = choice;
+    bestCost = cost;
+    return true;
+  };
+  if (assignments <= kExhaustiveLayouts) {
+    std::vector<size_t> choice(temps.size(), 0);
+    for (size_t n = 0; n < assignments; n++) {
+      size_t rest = n;
+      for (size_t i = 0; i < temps.size(); i++) {
+        choice[i] = rest % layouts[i].size();
+        rest /= layouts[i].size();
+      }
+      update(choice);
+    }
+  } else {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 0; i < temps.size(); i++) {
+        auto choice = best;
+        for (size_t l = 0; l < layouts[i].size(); l++) {
+          choice[i] = l;
+          changed |= update(choice);
+        }
+      }
+    }
+  }
+  return apply(best);
+}
+
+void TacticEmitter::emitHow(const std::vector<Comprehension> &stmts,
+                            llvm::raw_ostream &hos) {
+  // what = how.
+  if (stmts.size() == 1) {
+    Emitter(stmts[0], hos).emitHow();
+    return;
+  }
+
+  // the operands of the what statement are not temporaries.
+  auto &symbolTable = Emitter::symbolTable_;
+  std::set<std::string> operands;
+  applyRecursive(stmts[0], [&](const TreeRef &t) {
+    if (t->kind() != TK_APPLY && t->kind() != TK_COMPREHENSION)
+      return;
+    Tensor tensor;
+    auto indexes = t->tree(1)->trees();
+    tensor.name_ = Ident(t->tree(0)).name();
+    if (builtin_functions.count(tensor.name_))
+      return;
+    for (const auto &index : indexes) {
+      if (index->kind() != TK_IDENT)
+        return;
+      tensor.indices_.push_back(Ident(index).name());
+      tensor.dims_.push_back({Ident(index).name()});
+    }
+    operands.insert(tensor.name_);
+    symbolTable.registerTensor(tensor);
+  });
+  emitStatements(assignLayouts(fuseElementwise(stmts, operands), operands),
+                 operands, hos);
+}
+
+// A reshape into a fresh temporary can alias its source if the writes to
+// one are never observed through the other: the source (or "storage", the
+// buffer holding it) is not accessed after the temporary is written and
+// viceversa. An update of a temporary aliasing an operand of the what is
+// visible to the caller. The exception is a temporary updated and then
+// written back to the source with the inverse reshape, possibly through
+// other views (i.e., the output of a TTGT), the write-back is then elided.
+static bool canAlias(const std::vector<Comprehension> &stmts, size_t i,
+                     const std::string &storage, bool isOperand) {
+  auto source = Apply(stmts[i].rhs()).name().name();
+  // the temporary and the later reshapes of it.
+  std::set<std::string> views = {stmts[i].ident().name()};
+  llvm::raw_null_ostream nos;
+  bool viewWritten = false, sourceWritten = false;
+  for (size_t j = i + 1; j < stmts.size(); j++) {
+    auto tensors = getTensors(stmts[j]);
+    bool isReshape = tensors.size() == 2 && views.count(tensors[1]) &&
+                     Emitter(stmts[j], nos).matchView();
+    if (isReshape && !sourceWritten && find(tensors[0], {source, storage})) {
+      // neither is written after the write-back.
+      for (size_t k = j + 1; k < stmts.size(); k++) {
+        auto lhs = stmts[k].ident().name();
+        if (views.count(lhs) || find(lhs, {source, storage}))
+          return false;
+      }
+      return true;
+    }
+    bool readsSource = find(source, tensors) || find(storage, tensors);
+    bool readsView = false;
+    for (const auto &name : tensors)
+      readsView |= views.count(name);
+    if ((viewWritten && readsSource) || (sourceWritten && readsView))
+      return false;
+    viewWritten |= views.count(tensors[0]);
+    sourceWritten |= find(tensors[0], {source, storage});
+    if (isReshape)
+      views.insert(tensors[0]);
+  }
+  return !(viewWritten && isOperand);
+}
+
+void TacticEmitter::emitStatements(const std::vector<Comprehension> &stmts,
+                                   const std::set<std::string> &operands,
+                                   llvm::raw_ostream &hos) {
+  auto &symbolTable = Emitter::symbolTable_;
+  // liveness: first and last how statement accessing each temporary.
+  std::map<std::string, size_t> firstUse, lastUse;
+  for (size_t i = 1; i < stmts.size(); i++) {
+    for (const auto &name : getTensors(stmts[i])) {
+      symbolTable.reserve(name);
+      if (operands.count(name))
+        continue;
+      if (!firstUse.count(name))
+        firstUse[name] = i;
+      lastUse[name] = i;
+    }
+  }
+
+  // temporary -> buffer.
+  std::map<std::string, std::string> buffers;
+  for (size_t i = 1; i < stmts.size(); i++) {
+    auto stmt = Comprehension(renameTensors(stmts[i], buffers));
+    auto lhs = stmts[i].ident().name();
+    Tensor view;
+    if (firstUse.count(lhs) && !buffers.count(lhs)) {
+      auto resolved = resolveIndices(stmt, symbolTable);
+      Tensor tensor;
+      for (const auto &index : stmt.indices()) {
+        tensor.indices_.push_back(index.name());
+        tensor.dims_.push_back(getSize({index.name()}, resolved));
+      }
+      // a view does not need storage, the emitter registers it as an
+      // alias of its input.
+      bool isView = Emitter(stmt, hos).matchView();
+      if (isView) {
+        auto source = Apply(stmt.rhs()).name().name();
+        auto storage = symbolTable.getStorage(source);
+        isView = canAlias(stmts, i, storage, operands.count(storage));
+      }
+      tensor.name_ =
+          (isView) ? lhs
+                   : symbolTable.acquireBuffer(
+                         getSize(tensor.indices_, resolved), lhs);
+      if (!isView)
+        symbolTable.registerTensor(tensor);
+      else
+        view = tensor;
+      buffers[lhs] = tensor.name_;
+      stmt = Comprehension(renameTensors(stmts[i], buffers));
+    }
+
+    Emitter(stmt, hos).emitHow();
+    if (!view.name_.empty())
+      symbolTable.registerTensor(view);
+
+    for (const auto &it : lastUse) {
+      auto buffer = buffers.find(it.first);
+      if (it.second == i && buffer != buffers.end())
+        symbolTable.releaseBuffer(buffer->second);
+    }
+  }
+}
+
+// Emit the builders of the how in "stmts", the first statement is the
+// what.
+std::string
+TacticEmitter::emitVersion(const std::vector<Comprehension> &stmts) {
+  Emitter::symbolTable_.reset();
+  std::string how;
+  llvm::raw_string_ostream hos(how);
+  emitHow(stmts, hos);
+  hos.flush();
+  return how;
+}
+
+// Evaluate the shape predicate "t" over the extents of the indices, false
+// if it depends on an unknown extent.
+static bool evaluateGuard(const TreeRef &t,
+                          const std::map<std::string, int64_t> &extents,
+                          int64_t &value) {
+  switch (t->kind()) {
+  case TK_CONST:
+    value = Const(t).value();
+    return true;
+  case TK_IDENT: {
+    auto it = extents.find(Ident(t).name());
+    if (it == extents.end())
+      return false;
+    value = it->second;
+    return true;
+  }
+  case TK_AND:
+  case TK_OR: {
+    // a single operand may decide the result.
+    int64_t lhs, rhs;
+    bool isAnd = t->kind() == TK_AND;
+    bool hasLhs = evaluateGuard(t->tree(0), extents, lhs);
+    bool hasRhs = evaluateGuard(t->tree(1), extents, rhs);
+    if ((hasLhs && bool(lhs) != isAnd) || (hasRhs && bool(rhs) != isAnd)) {
+      value = !isAnd;
+      return true;
+    }
+    value = isAnd;
+    return hasLhs && hasRhs;
+  }
+  case '<':
+  case '>':
+  case TK_LE:
+  case TK_GE:
+  case TK_EQ:
+  case TK_NE:
+  case '+':
+  case '-':
+  case '*':
+  case '/': {
+    if (t->trees().size() == 1) {
+      // unary minus.
+      if (!evaluateGuard(t->tree(0), extents, value))
+        return false;
+      value = -value;
+      return true;
+    }
+    int64_t lhs, rhs;
+    if (!evaluateGuard(t->tree(0), extents, lhs) ||
+        !evaluateGuard(t->tree(1), extents, rhs))
+      return false;
+    switch (t->kind()) {
+    case '<':
+      value = lhs < rhs;
+      break;
+    case '>':
+      value = lhs > rhs;
+      break;
+    case TK_LE:
+      value = lhs <= rhs;
+      break;
+    case TK_GE:
+      value = lhs >= rhs;
+      break;
+    case TK_EQ:
+      value = lhs == rhs;
+      break;
+    case TK_NE:
+      value = lhs != rhs;
+      break;
+    case '+':
+      value = lhs + rhs;
+      break;
+    case '-':
+      value = lhs - rhs;
+      break;
+    case '*':
+      value = lhs * rhs;
+      break;
+    default:
+      if (!rhs)
+        throw ErrorReport(t) << "division by zero in guard";
+      value = lhs / rhs;
+    }
+    return true;
+  }
+  }
+  throw ErrorReport(t) << "expect only extents, constants, comparisons, "
+                          "'&&', '||', '+', '-', '*' and '/' in guard";
+}
+
+void TacticEmitter::emit() {
+  Emitter::symbolTable_.reset();
+  Emitter::target_ = target_;
+  Emitter::elementTypes_.clear();
+  Emitter::elementSizes_.clear();
+  Emitter::storageFormats_.clear();
+  for (const auto &param : tactic_.params()) {
+    auto name = param.ident().name();
+    if (!param.typeIsInferred()) {
+      auto scalarType = param.tensorType().scalarTypeTree();
+      Emitter::elementTypes_[name] = toElementType(scalarType);
+      Emitter::elementSizes_[name] =
+          std::max<int64_t>(TypeInfo(scalarType).bits() / 8, 1);
+    }
+    if (!param.format().present())
+      continue;
+    auto format = param.format().get();
+    if (format.name() != "csr" && format.name() != "coo")
+      throw ErrorReport(format) << "expect csr or coo but got "
+                                << format.name();
+    Emitter::storageFormats_[name] = format.name();
+  }
+
+  std::vector<Comprehension> stmts;
+  for (const auto &stmt : tactic_.statements())
+    stmts.push_back(stmt);
+  auto what = stmts[0];
+  std::set<std::string> indices;
+  applyRecursive(what, [&](const TreeRef &t) {
+    if (t->kind() == TK_APPLY || t->kind() == TK_COMPREHENSION)
+      applyRecursive(t->tree(1), [&](const TreeRef &index) {
+        if (index->kind() == TK_IDENT)
+          indices.insert(Ident(index).name());
+      });
+  });
+
+  // the guards known statically select or discard their version, the
+  // others are checked by the dispatch in order.
+  std::map<std::string, int64_t> extents;
+  getExtents(what, extents);
+  std::vector<std::pair<TreeRef, std::vector<Comprehension>>> versions;
+  for (const auto &variant : tactic_.variants()) {
+    applyRecursive(variant.guard(), [&](const TreeRef &t) {
+      if (t->kind() == TK_IDENT && !indices.count(Ident(t).name()))
+        throw ErrorReport(t) << "expect an index of the what but got "
+                             << Ident(t).name();
+    });
+    std::vector<Comprehension> how = {what};
+    for (const auto &stmt : variant.statements())
+      how.push_back(stmt);
+    int64_t value;
+    if (!evaluateGuard(variant.guard(), extents, value))
+      versions.push_back({variant.guard(), how});
+    else if (value) {
+      stmts = how;
+      break;
+    }
+  }
+
+  if (versions.empty()) {
+    auto how = emitVersion(stmts);
+    os << "// Peak intermediate footprint: "
+       << Emitter::symbolTable_.getPeakFootprint() << "\n";
+    Emitter(what, os).emitWhat();
+    os << "[\n" << how;
+    os.indent(2) << "eraseOpBuilder\n";
+    os << "]>;\n";
+    return;
+  }
+
+  versions.push_back({nullptr, stmts});
+  std::string how;
+  llvm::raw_string_ostream hos(how);
+  for (const auto &version : versions) {
+    auto builders = emitVersion(version.second);
+    hos.indent(2) << "// Peak intermediate footprint: "
+                  << Emitter::symbolTable_.getPeakFootprint() << "\n";
+    hos.indent(2) << "dispatchBuilder<Guard<\"";
+    if (version.first)
+      recursivelyEmitRhs(version.first, hos);
+    else
+      hos << "true";
+    hos << "\">, [\n";
+    // nest the builders of the version.
+    size_t begin = 0, end;
+    while ((end = builders.find('\n', begin)) != std::string::npos) {
+      hos.indent(2) << builders.substr(begin, end - begin + 1);
+      begin = end + 1;
+    }
+    hos.indent(2) << "]>,\n";
+  }
+  hos.flush();
+  Emitter(what, os).emitWhat();
+  os << "[\n" << how;
+  os.indent(2) << "eraseOpBuilder\n";
+  os << "]>;\n";
+}
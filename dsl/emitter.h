@@ -5,14 +5,43 @@
 #include "tree_views.h"
 #include "llvm/Support/raw_ostream.h"
 #include <map>
+#include <set>
 
 enum class Trans { N, T };
 
-// TODO add better support for conv.
+// out(n, o, h, w) += filt(o, c, kh, kw) *
+//                     image(n, c, sh*h + dh*kh - ph, sw*w + dw*kw - pw)
+// Batch (n) and channel (o, c) indices are optional.
 struct ConvInfo {
   std::string out;
   std::string filt;
   std::string img;
+
+  // per spatial dimension (h, w) in image order. Strides and dilations
+  // are constants or scalar parameters (i.e., "2" or "s").
+  std::vector<std::string> strides;
+  std::vector<std::string> dilations;
+  std::vector<int> paddings;
+
+  // image layout (i.e., NCHW or NHWC), empty if
+  // there are no batch and channel indices.
+  std::string layout;
+
+  std::vector<std::string> outIndices;
+  std::vector<std::string> filtIndices;
+  // role of each index: batch (N), input channel (C), output channel (K),
+  // filter spatial (R, S) and output spatial (P, Q).
+  std::map<std::string, char> roles;
+  // extents from range constraints (i.e., where c in 0:3).
+  std::map<std::string, int64_t> extents;
+};
+
+// Loops of a builder: the parallel ones write distinct output elements,
+// the reduction ones accumulate into the same element. If both are empty
+// the loops of the statement are used.
+struct LoopDims {
+  std::vector<std::string> parallel;
+  std::vector<std::string> reduction;
 };
 
 struct MatMulInfo {
@@ -33,6 +62,135 @@ struct MatMulInfo {
   int dimensionsForM;
   int dimensionsForN;
   int dimensionsForK;
+
+  // elementwise operations applied to the product (%acc) before
+  // storing the output tile, i.e., "tanh(%acc + bias(j))".
+  std::string epilogue;
+  std::vector<std::string> epilogueInputs;
+
+  // tile sizes {m, n, k} for the L1, L2 and L3 caches, empty if the
+  // extents are unknown.
+  std::vector<std::vector<int64_t>> tiles;
+  LoopDims dims;
+};
+
+// out(k, p, q) += filt(k, c, r, s) * image(c, p + r, q + s) lowered as
+// patch(c, r, s, p, q) = im2col(image) followed by a matmul.
+struct Im2colInfo {
+  ConvInfo conv;
+  std::string patch;
+  std::vector<std::string> patchIndices;
+  // patch layout using the index roles (i.e., CRSPQ).
+  std::string patchLayout;
+  MatMulInfo mmi;
+};
+
+// Winograd F(m x m, 3 x 3) for a unit-stride 3x3 conv: transform the filter
+// and the image tiles, multiply them with a batched matmul over the
+// (m + 2)^2 points of each tile and transform back the output.
+struct WinogradInfo {
+  ConvInfo conv;
+  // output tile size (2 or 4).
+  int m;
+  // transformed filter, image and output.
+  std::string filt;
+  std::string img;
+  std::string out;
+  // layouts using the index roles (i.e., KCRS).
+  std::string filtLayout;
+  std::string outLayout;
+  // tiles along P and Q.
+  std::string tilesP;
+  std::string tilesQ;
+};
+
+// C(i, j) += (int32(A(i, k)) - za) * (int32(B(k, j)) - zb) over int8
+// operands, with zero points za and zb.
+struct QuantizedMatMulInfo {
+  // the epilogue holds the requantization, if any.
+  MatMulInfo mmi;
+  std::string zeroPointA;
+  std::string zeroPointB;
+  // type of the integer casts, i.e., "i32".
+  std::string accumulatorType;
+};
+
+// C(i, j) min= A(i, k) + B(k, j): a matmul over the (min, +) semiring. The
+// reduction gives the addition and the rhs operator the multiplication.
+struct SemiringMatMulInfo {
+  // i.e., "min-plus", "max-times" or "or-and" for boolean operands.
+  std::string semiring;
+  // transposes and dimensions of the operands, alpha and beta are unused.
+  MatMulInfo mmi;
+  // bool operands of a boolean semiring are packed into 64-bit words.
+  bool isPacked = false;
+};
+
+// C(i, j) += A(i, k) * A(j, k) (trans = N) or C(i, j) += A(k, i) * A(k, j)
+// (trans = T). With B the rank-2k update C += A * B^T + B * A^T. C is
+// symmetric: only the lower triangle is computed.
+struct SyrkInfo {
+  std::string C;
+  std::string A;
+  // empty for a rank-k update.
+  std::string B;
+
+  Trans trans;
+
+  std::string alpha;
+  std::string beta;
+};
+
+// C(b, i, j) += A(b, i, k) * B(b, k, j) where the batch indices (b)
+// appear in all the operands, possibly at different positions.
+struct BatchedMatMulInfo {
+  std::string C;
+  std::string A;
+  std::string B;
+
+  Trans transa;
+  Trans transb;
+
+  std::string alpha;
+  std::string beta;
+
+  // position of each batch index in A, B and C.
+  std::vector<size_t> batchDimsA;
+  std::vector<size_t> batchDimsB;
+  std::vector<size_t> batchDimsC;
+
+  LoopDims dims;
+};
+
+// s += x(i) * y(i)
+struct DotInfo {
+  std::string s;
+  std::string x;
+  std::string y;
+};
+
+// y(i) += alpha * x(i)
+struct AxpyInfo {
+  std::string y;
+  std::string x;
+
+  std::string alpha;
+};
+
+// x(i) = alpha * x(i) or x(i) *= alpha
+struct ScalInfo {
+  std::string x;
+
+  std::string alpha;
+};
+
+// C(i, j) += alpha * x(i) * y(j)
+struct GerInfo {
+  std::string C;
+  std::string x;
+  std::string y;
+
+  std::string alpha;
 };
 
 struct MatVecInfo {
@@ -58,31 +216,116 @@ struct ReshapeInfo {
   std::vector<std::vector<std::string>> oldVars;
 };
 
+// T(i, j) = exp(A(i, j) + B(j)): pointwise on the output, no reductions.
+struct ElementwiseInfo {
+  std::string out;
+  std::vector<std::string> inputs;
+  // the statement, i.e., "T(i, j) = exp(A(i, j) + B(j))".
+  std::string expr;
+};
+
 struct TransposeInfo {
   std::string lhs;
   std::string rhs;
 
   std::vector<size_t> permutation;
+
+  // tile sizes of the output dimensions for the L1, L2 and L3 caches,
+  // empty if the extents are unknown.
+  std::vector<std::vector<int64_t>> tiles;
+  LoopDims dims;
 };
 
+// Number of elements of a tensor (or of a dimension) expressed as the
+// sorted list of base indices whose extents multiply together. With
+// "where f = a * c" the dimension f has size {a, c}.
+using SymbolicSize = std::vector<std::string>;
+
 struct Tensor {
   std::string name_;
   std::vector<std::string> indices_;
+  // base indices for each dimension.
+  std::vector<SymbolicSize> dims_;
+};
+
+// D(i, l) += A(i, j) * B(j, k) * C(k, l) lowered as a chain of binary
+// contractions. The operands are the inputs followed by the intermediate
+// produced by each step of the path.
+struct ContractionInfo {
+  std::string out;
+  std::vector<std::string> outIndices;
+  std::vector<Tensor> operands;
+  // operands contracted at each step, step i produces operand
+  // inputs + i. The last step writes the output.
+  std::vector<std::pair<size_t, size_t>> path;
+  // extents from range constraints (i.e., where j in 0:1000).
+  std::map<std::string, int64_t> extents;
 };
 
 class SymbolTableMap {
 public:
   SymbolTableMap() : nextId_(0), lastEmittedVar_(""){};
-  std::string getNextVariable();
+  void reset();
+  // Return a buffer of size `size` for an emitter-generated temporary,
+  // reusing a dead buffer when possible.
+  std::string getNextVariable(const SymbolicSize &size);
+  // Return a fresh name for a temporary that aliases the storage of
+  // another tensor, no buffer is allocated for it.
+  std::string getNextView();
   std::string getLastEmittedVariable() const;
 
+  // Names used by the tactic, never handed out for fresh temporaries.
+  void reserve(const std::string &name);
+  void registerTensor(const Tensor &tensor);
+  bool hasTensor(const std::string &name) const;
+  bool lookupTensor(const std::string &name, Tensor &tensor) const;
+  // `view` shares the storage of `source`.
+  void registerView(const std::string &view, const std::string &source);
+  // Return the buffer holding the data of `name`.
+  std::string getStorage(const std::string &name) const;
+
+  // Return a dead buffer with the same size or `name` if none is available.
+  std::string acquireBuffer(const SymbolicSize &size, const std::string &name);
+  // Mark `name` as dead, its storage can be reused by later outputs once
+  // all the views on it are dead too.
+  void releaseBuffer(const std::string &name);
+  // Sum of all the distinct intermediate buffers. As each buffer is live
+  // for the entire tactic this is the intermediate high-water mark.
+  std::string getPeakFootprint() const;
+
 private:
   size_t nextId_;
   std::string lastEmittedVar_;
   // key tensor name, value Tensor.
   std::map<std::string, Tensor> symbolTable_;
+  std::set<std::string> reserved_;
+  // all the intermediate buffers with their size.
+  std::map<std::string, SymbolicSize> buffers_;
+  // dead buffers available for reuse.
+  std::vector<std::string> freeBuffers_;
+  // key view, value the buffer it aliases.
+  std::map<std::string, std::string> views_;
+  std::set<std::string> dead_;
+};
+
+// Target properties used to choose among alternative lowerings.
+struct TargetInfo {
+  // data caches available to a core, in bytes.
+  int64_t l1CacheSize = 32 * 1024;
+  int64_t l2CacheSize = 1024 * 1024;
+  int64_t l3CacheSize = 32 * 1024 * 1024;
+  // vector register width, in bytes.
+  int64_t vectorWidth = 32;
+  // element size of the untyped tensors, in bytes.
+  int64_t elementSize = 4;
+  // memory available for a single intermediate, in bytes.
+  int64_t memoryLimit = int64_t(1) << 30;
 };
 
+// Return the target description of the host, the cache sizes are queried
+// from the system when available.
+TargetInfo getHostTargetInfo();
+
 class Emitter {
 public:
   Emitter(lang::Comprehension co, llvm::raw_ostream &os)
@@ -93,35 +336,138 @@ public:
   // MatMul.
   bool matchAndEmitMatMul();
   bool matchMatMul(MatMulInfo &mmi);
+  bool matchGroupedMatMul(MatMulInfo &mmi);
+  bool matchMatMulWithEpilogue(MatMulInfo &mmi);
   void emitMatMul(const MatMulInfo &mmi);
+  void emitSpMM(const MatMulInfo &mmi);
+  void getMatMulTiles(MatMulInfo &mmi);
+
+  // Quantized MatMul.
+  bool matchAndEmitQuantizedMatMul();
+  bool matchQuantizedMatMul(QuantizedMatMulInfo &qi);
+  void emitQuantizedMatMul(const QuantizedMatMulInfo &qi);
+
+  // Semiring MatMul.
+  bool matchAndEmitSemiringMatMul();
+  bool matchSemiringMatMul(SemiringMatMulInfo &smi);
+  void emitSemiringMatMul(const SemiringMatMulInfo &smi);
+
+  // Symmetric rank-k and rank-2k updates.
+  bool matchAndEmitSyrk();
+  bool matchSyrk(SyrkInfo &si);
+  bool matchSyr2k(SyrkInfo &si);
+  void emitSyrk(const SyrkInfo &si);
+
+  // Batched MatMul.
+  bool matchAndEmitBatchedMatMul();
+  bool matchBatchedMatMul(BatchedMatMulInfo &bmi);
+  void emitBatchedMatMul(const BatchedMatMulInfo &bmi);
 
   // MatVec.
   bool matchAndEmitMatVec();
   bool matchMatVec(MatVecInfo &mvi);
   void emitMatVec(const MatVecInfo &mvi);
+  void emitSpMV(const MatVecInfo &mvi);
+
+  // Outer product.
+  bool matchAndEmitGer();
+  bool matchGer(GerInfo &gi);
+  void emitGer(const GerInfo &gi);
+
+  // BLAS level 1.
+  bool matchAndEmitDot();
+  bool matchDot(DotInfo &di);
+  void emitDot(const DotInfo &di);
+  bool matchAndEmitAxpy();
+  bool matchAxpy(AxpyInfo &ai);
+  void emitAxpy(const AxpyInfo &ai);
+  bool matchAndEmitScal();
+  bool matchScal(ScalInfo &si);
+  void emitScal(const ScalInfo &si);
 
   // Reshape.
   bool matchAndEmitReshape();
   bool matchReshape(ReshapeInfo &rti);
+  bool matchView();
   void emitReshape(const ReshapeInfo &rti);
-  // TODO: remove me and handle multiple where clauses
-  // better.
-  void printGroup(const ReshapeInfo &rti);
-
   // Transpose
   bool matchAndEmitTranspose();
   bool matchTranspose(TransposeInfo &rti);
   void emitTranspose(const TransposeInfo &rti);
+  void getTransposeTiles(TransposeInfo &ti);
+
+  // Elementwise
+  bool matchAndEmitElementwise();
+  bool matchElementwise(ElementwiseInfo &ei);
+  void emitElementwise(const ElementwiseInfo &ei);
 
   // Conv
   bool matchAndEmitConv();
   bool matchConv(ConvInfo &cvi);
   void emitConv(const ConvInfo &cvi);
+  bool matchIm2col(const ConvInfo &cvi, Im2colInfo &ii);
+  void emitIm2col(const Im2colInfo &ii);
+  bool matchWinograd(const ConvInfo &cvi, WinogradInfo &wi);
+  void emitWinograd(const WinogradInfo &wi);
+
+  // Contraction of more than two operands.
+  bool matchAndEmitContraction();
+  bool matchContraction(ContractionInfo &ci);
+  void emitContraction(ContractionInfo &ci);
 
 private:
   lang::Comprehension comprehension_;
   llvm::raw_ostream &os;
   static thread_local SymbolTableMap symbolTable_;
+  static thread_local TargetInfo target_;
+  // element types of the typed tensors (i.e., "f16"), untyped tensors
+  // are missing.
+  static thread_local std::map<std::string, std::string> elementTypes_;
+  // element sizes in bytes of the typed tensors.
+  static thread_local std::map<std::string, int64_t> elementSizes_;
+  // storage formats of the sparse tensors (i.e., "csr"), dense tensors
+  // are missing.
+  static thread_local std::map<std::string, std::string> storageFormats_;
+  // elements moved by each transpose emitted so far.
+  static thread_local std::vector<SymbolicSize> transposed_;
+
+  bool getElementTypes(const MatMulInfo &mmi, std::string &inputType,
+                       std::string &accumulatorType);
+  int64_t getElementSize(const std::string &name) const;
+  std::string getStorageFormat(const std::string &name) const;
+  LoopDims getLoopDims() const;
+  void emitLoopDims(const LoopDims &dims = LoopDims());
+
+  friend class TacticEmitter;
+};
+
+// Emit a full tactic: the what statement followed by the builders for
+// each how statement. Chains of elementwise statements are fused and
+// temporaries that are dead are reused for later outputs with the same
+// size. The dimension order of the temporaries is chosen to minimize the
+// data moved by transposes. A tactic with guarded hows is emitted as a
+// dispatch over the versions whose guard is not known statically.
+class TacticEmitter {
+public:
+  TacticEmitter(lang::Tac tactic, llvm::raw_ostream &os,
+                TargetInfo target = TargetInfo())
+      : tactic_(tactic), os(os), target_(target) {}
+  void emit();
+
+private:
+  std::string emitVersion(const std::vector<lang::Comprehension> &stmts);
+  void emitHow(const std::vector<lang::Comprehension> &stmts,
+               llvm::raw_ostream &hos);
+  void emitStatements(const std::vector<lang::Comprehension> &stmts,
+                      const std::set<std::string> &operands,
+                      llvm::raw_ostream &hos);
+  std::vector<lang::Comprehension>
+  assignLayouts(const std::vector<lang::Comprehension> &stmts,
+                const std::set<std::string> &operands);
+
+  lang::Tac tactic_;
+  llvm::raw_ostream &os;
+  TargetInfo target_;
 };
 
 #endif
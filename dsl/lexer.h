@@ -46,6 +46,7 @@ namespace lang {
   _(TK_MIN, "min", "min")                                                      \
   _(TK_MAX, "max", "max")                                                      \
   _(TK_WHERE, "where", "where")                                                \
+  _(TK_WHEN, "when", "when")                                                   \
   _(TK_DEF, "def", "def")                                                      \
   _(TK_ARROW, "arrow", "->")                                                   \
   _(TK_EQUIVALENT, "equivalent", "<=>")                                        \
@@ -81,6 +82,7 @@ namespace lang {
   _(TK_INT32, "int32", "int32")                                                \
   _(TK_INT64, "int64", "int64")                                                \
   _(TK_FLOAT16, "float16", "float16")                                          \
+  _(TK_BFLOAT16, "bfloat16", "bfloat16")                                       \
   _(TK_FLOAT32, "float32", "float32")                                          \
   _(TK_FLOAT64, "float64", "float64")                                          \
   _(TK_FLOAT, "float", "float")                                                \
@@ -283,6 +285,7 @@ struct SharedParserData {
     case TK_INT32:
     case TK_INT64:
     case TK_FLOAT16:
+    case TK_BFLOAT16:
     case TK_FLOAT32:
     case TK_FLOAT64:
     case TK_FLOAT:
@@ -187,11 +187,19 @@ struct Parser {
     if (L.cur().kind == TK_IDENT) {
       auto ident = parseIdent();
       return Param::create(ident->range(), ident,
-                           c(TK_INFERRED, ident->range(), {}));
+                           c(TK_INFERRED, ident->range(), {}),
+                           parseFormat());
     }
     auto typ = parseType();
     auto ident = parseIdent();
-    return Param::create(typ->range(), ident, typ);
+    return Param::create(typ->range(), ident, typ, parseFormat());
+  }
+  // optional storage format of a sparse tensor, i.e., A : csr
+  TreeRef parseFormat() {
+    auto r = L.cur().range;
+    if (L.nextIf(':'))
+      return c(TK_OPTION, r, {parseIdent()});
+    return c(TK_OPTION, r, {});
   }
   TreeRef parseWhereClauses() {
     if (L.nextIf(TK_WHERE)) {
@@ -299,6 +307,11 @@ struct Parser {
   TreeRef parseTactic() {
     L.expect(TK_DEF);
     auto name = parseIdent();
+    // optional element types of the tensors, i.e., (float16 A, float C).
+    TreeRef paramlist = List::create(L.cur().range, {});
+    if (L.cur().kind == '(')
+      paramlist =
+          parseList('(', ',', ')', [&](int i) { return parseParam(); });
     L.expect('{');
     auto r = L.cur().range;
     bool needHow = false;
@@ -311,14 +324,33 @@ struct Parser {
     stmts.push_back(parseStmt());
     if (stmts.size() > 1)
       throw ErrorReport(stmts[0]) << "what clause expect single stmt\n";
+    // how when guard ... how: the guarded hows come first, the last how
+    // has no guard.
+    TreeList variants;
     if (needHow) {
       L.expect(TK_HOW);
+      while (L.nextIf(TK_WHEN)) {
+        auto guard = parseExp();
+        TreeList body;
+        while (!L.nextIf(TK_HOW)) {
+          if (L.cur().kind == '}')
+            throw ErrorReport(guard) << "expect a how without guard after "
+                                        "the guarded ones";
+          body.push_back(parseStmt());
+        }
+        variants.push_back(Variant::create(
+            guard->range(), guard, List::create(r, std::move(body))));
+      }
       while (!L.nextIf('}')) {
+        if (L.cur().kind == TK_HOW)
+          throw ErrorReport(L.cur().range)
+              << "the how without guard must be the last one";
         stmts.push_back(parseStmt());
       }
     }
     auto stmts_list = List::create(r, std::move(stmts));
-    return Tac::create(name->range(), name, stmts_list);
+    return Tac::create(name->range(), name, paramlist, stmts_list,
+                       List::create(r, std::move(variants)));
   }
 
   Lexer L;
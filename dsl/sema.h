@@ -30,7 +30,7 @@ namespace lang {
 // dependency for this trivial functionality, and it allows us to
 // modify the behavior in the future
 struct TypeInfo {
-  enum Code { Int, UInt, Float };
+  enum Code { Int, UInt, Float, BFloat };
   TypeInfo(Code code_, uint8_t bits_) : code_(code_), bits_(bits_) {}
   TypeInfo(TreeRef scalar_type) {
     switch (scalar_type->kind()) {
@@ -49,6 +49,7 @@ struct TypeInfo {
       TYPE_INFO_OPTION(TK_INT32, Int, 32)
       TYPE_INFO_OPTION(TK_INT64, Int, 64)
       TYPE_INFO_OPTION(TK_FLOAT16, Float, 16)
+      TYPE_INFO_OPTION(TK_BFLOAT16, BFloat, 16)
       TYPE_INFO_OPTION(TK_FLOAT32, Float, 32)
       TYPE_INFO_OPTION(TK_FLOAT64, Float, 64)
       TYPE_INFO_OPTION(TK_FLOAT, Float, 32)
@@ -59,12 +60,6 @@ struct TypeInfo {
       throw ErrorReport(scalar_type)
           << "Unhandled TC scalar type: " << scalar_type;
     }
-
-    if (code_ == Code::Float && bits_ == 16) {
-      throw ErrorReport(scalar_type)
-          << "Half precision floating point not supported "
-          << "until we can make NVRTC include system headers";
-    }
   }
   int toScalarToken() const {
     switch (code()) {
@@ -101,13 +96,18 @@ struct TypeInfo {
       case 64:
         return TK_DOUBLE;
       }
+    case BFloat:
+      switch (bits()) {
+      case 16:
+        return TK_BFLOAT16;
+      }
     }
 
     throw std::runtime_error("Unknown type info?");
   }
   Code code() const { return code_; }
   uint8_t bits() const { return bits_; }
-  bool is_float() const { return code_ == Float; }
+  bool is_float() const { return code_ == Float || code_ == BFloat; }
   bool is_uint() const { return code_ == UInt; }
 
 private:
@@ -132,6 +132,9 @@ static inline TreeRef match_types(TreeRef a, TreeRef b) {
   } else if (ta.is_float() && !tb.is_float()) {
     return a;
   } else if (ta.is_float() && tb.is_float()) {
+    // float16(a) * bfloat16(b) -> float32
+    if (ta.bits() == tb.bits())
+      return Compound::create(TK_FLOAT, a->range(), {});
     // float(a) * float(b) -> float(max(a, b))
     if (ta.bits() > tb.bits())
       return a;
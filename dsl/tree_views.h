@@ -34,9 +34,13 @@ namespace lang {
 // -- NB: dim_list can only contain Const and Ident trees
 // -- NB: dim_list is optional (can be empty)
 // Type  = TensorType(ScalarType scalar_type, List<Expr> dim_list)      TK_TENSOR_TYPE
-// Param = Param(Ident name, Type type)                                 TK_PARAM
+// Param = Param(Ident name, Type type, Option<Ident> format)           TK_PARAM
 //
 // Def   = Def(Ident name, List<Param> params, List<Param> returns, List<Stmt> body) TK_DEF
+// Tac   = Tac(Ident name, List<Param> params, List<Stmt> body,       TK_DEF
+//              List<Variant> variants)
+// -- NB: an empty body lowers the what as is
+// Variant = Variant(Expr guard, List<Stmt> body)                       TK_HOW
 //
 // -- NB: reduction_variables are only filled during semantic analysis
 // Stmt  = Comprehension(Ident lhs_ident, List<Ident> lhs_indices,      TK_COMPREHENSION
@@ -241,10 +245,11 @@ struct TensorType : public TreeView {
 
 struct Param : public TreeView {
   explicit Param(const TreeRef &tree) : TreeView(tree) {
-    tree_->expect(TK_PARAM, 2);
+    tree_->expect(TK_PARAM, 3);
   }
-  static TreeRef create(const SourceRange &range, TreeRef ident, TreeRef type) {
-    return Compound::create(TK_PARAM, range, {ident, type});
+  static TreeRef create(const SourceRange &range, TreeRef ident, TreeRef type,
+                        TreeRef format) {
+    return Compound::create(TK_PARAM, range, {ident, type, format});
   }
   // when the type of a field is statically know the accessors return
   // the wrapped type. for instance here we know ident_ is an identifier
@@ -257,6 +262,8 @@ struct Param : public TreeView {
   bool typeIsInferred() const { return type()->kind() == TK_INFERRED; }
   // helper for when you know the type is not inferred.
   TensorType tensorType() const { return TensorType(type()); }
+  // storage format of a sparse tensor (i.e., csr), missing if dense.
+  OptionView<Ident> format() const { return OptionView<Ident>(subtree(2)); }
 };
 
 struct Equivalent : public TreeView {
@@ -340,17 +347,40 @@ struct Def : public TreeView {
   }
 };
 
+// a how used only when the shape predicate "guard" over the extents of
+// the indices holds, i.e., how when j == 1.
+struct Variant : public TreeView {
+  explicit Variant(const TreeRef &tree) : TreeView(tree) {
+    tree->expect(TK_HOW, 2);
+  }
+  TreeRef guard() const { return subtree(0); }
+  ListView<Comprehension> statements() const {
+    return ListView<Comprehension>(subtree(1));
+  }
+  static TreeRef create(const SourceRange &range, TreeRef guard,
+                        TreeRef stmts_list) {
+    return Compound::create(TK_HOW, range, {guard, stmts_list});
+  }
+};
+
 struct Tac : public TreeView {
   explicit Tac(const TreeRef &tree) : TreeView(tree) {
-    tree->expect(TK_DEF, 2);
+    tree->expect(TK_DEF, 4);
   }
   Ident name() { return Ident(subtree(0)); }
+  // may be empty, the tensors are then untyped.
+  ListView<Param> params() const { return ListView<Param>(subtree(1)); }
+  // the what followed by the default how.
   ListView<Comprehension> statements() const {
-    return ListView<Comprehension>(subtree(1));
+    return ListView<Comprehension>(subtree(2));
   }
+  // the guarded hows, tried in order before the default one.
+  ListView<Variant> variants() const { return ListView<Variant>(subtree(3)); }
   static TreeRef create(const SourceRange &range, TreeRef name,
-                        TreeRef stmts_list) {
-    return Compound::create(TK_DEF, range, {name, stmts_list});
+                        TreeRef paramlist, TreeRef stmts_list,
+                        TreeRef variants) {
+    return Compound::create(TK_DEF, range,
+                            {name, paramlist, stmts_list, variants});
   }
 };
 
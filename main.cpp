@@ -11,16 +11,9 @@
 
 using namespace lang;
 
-void emitTactic(ListView<Comprehension> stmts, llvm::raw_ostream &os) {
+void emitTactic(Tac tac, llvm::raw_ostream &os) {
   llvm::emitSourceFileHeader("Tactics", os);
-  if (stmts.size() < 2)
-    return;
-  Emitter(stmts[0], os).emitWhat();
-  for (size_t i = 1; i < stmts.size(); i++) {
-    Emitter(stmts[i], os).emitHow();
-  }
-  os << "eraseOpBuilder \n";
-  os << "]>;";
+  TacticEmitter(tac, os, getHostTargetInfo()).emit();
 }
 
 int main() {
@@ -39,7 +32,7 @@ int main() {
 
   Parser p = Parser(raw);
   auto tac = Tac(p.parseTactic());
-  emitTactic(tac.statements(), llvm::outs());
+  emitTactic(tac, llvm::outs());
 
   return 0;
 }
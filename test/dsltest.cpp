@@ -12,23 +12,8 @@ using namespace lang;
 
 void emitTactic(Parser &p, llvm::raw_ostream &os) {
   llvm::emitSourceFileHeader("Tactics", os);
-
   auto tac = Tac(p.parseTactic());
-  auto stmts = tac.statements();
-  os << "def " << Ident(tac.name()).name() << " : Tactics<";
-  Emitter(stmts[0], os).emitWhat();
-  os << "[\n";
-
-  // what = how
-  if (stmts.size() == 1)
-    Emitter(stmts[0], os).emitHow();
-  else {
-    for (size_t i = 1; i < stmts.size(); i++) {
-      Emitter(stmts[i], os).emitHow();
-    }
-  }
-  os.indent(2) << "eraseOpBuilder\n";
-  os << "]>;\n";
+  TacticEmitter(tac, os).emit();
 }
 
 TEST(DslTest, tensorWithCompactBuilder) {
@@ -52,37 +37,35 @@ TEST(DslTest, tensorWithCompactBuilder) {
   S.str();
 
   std::string pattern = "\"C(a, b, c) += A(a, c, d) * B(d, b)\"";
-  std::string builder1 = "transposeBuilder<Inputs<[\"C\"]>, "
-                         "Outputs<[\"tmp0\"]>, StrExpr<\"{0,2,1}\">>,";
-  std::string builder2 = "reshapeBuilder<Inputs<[\"tmp0\"]>, Outputs<[\"D\"]>, "
-												 "StrExpr<\"{{0, 1}, 2}\">>";
-  std::string builder3 = "reshapeBuilder<Inputs<[\"A\"]>, Outputs<[\"E\"]>, "
-                         "StrExpr<\"{{0, 1}, 2}\">>,";
-  std::string builder4 =
+  std::string builder1 = "permuteReshapeBuilder<Inputs<[\"C\"]>, "
+                         "Outputs<[\"D\"]>, StrExpr<\"{0,2,1}\">, "
+                         "StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"a\",\"c\",\"b\"]>, Reduction<[]>>,";
+  std::string builder2 = "reshapeViewBuilder<Inputs<[\"A\"]>, Outputs<[\"E\"]>, "
+                         "StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"f\",\"d\"]>, Reduction<[]>>,";
+  std::string builder3 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"E\",\"B\"]>, "
-      "Outputs<[\"D\"]>>,";
-  std::string builder5 = "reshapeBuilder<Inputs<[\"D\"]>, Outputs<[\"tmp1\"]>, "
-                         "StrExpr<\"{{0, 1}, 2}\">>,";
-  std::string builder6 = "transposeBuilder<Inputs<[\"tmp1\"]>, "
-                         "Outputs<[\"C\"]>, StrExpr<\"{0,2,1}\">>,";
-  std::string builder7 = "eraseOpBuilder";
+      "Outputs<[\"D\"]>, Parallel<[\"f\",\"b\"]>, Reduction<[\"d\"]>>,";
+  std::string builder4 = "permuteReshapeBuilder<Inputs<[\"D\"]>, "
+                         "Outputs<[\"C\"]>, StrExpr<\"{0,2,1}\">, "
+                         "StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"a\",\"b\",\"c\"]>, Reduction<[]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
   auto builder2Pos = res.find(builder2);
-	auto builder3Pos = res.find(builder3);
+  auto builder3Pos = res.find(builder3);
   auto builder4Pos = res.find(builder4);
-  auto builder5Pos = res.find(builder5);
-  auto builder6Pos = res.find(builder6);
 
   ASSERT_TRUE(patternPos != std::string::npos);
   ASSERT_TRUE(builder1Pos != std::string::npos);
   ASSERT_TRUE(builder2Pos != std::string::npos);
   ASSERT_TRUE(builder3Pos != std::string::npos);
   ASSERT_TRUE(builder4Pos != std::string::npos);
-  ASSERT_TRUE(builder5Pos != std::string::npos);
-  ASSERT_TRUE(builder6Pos != std::string::npos);
+  // no intermediate is needed to permute and regroup.
+  ASSERT_TRUE(res.find("tmp0") == std::string::npos);
 }
 
 TEST(DslTest, shouldLowerToTTGT) {
@@ -129,20 +112,23 @@ TEST(DslTest, tensorWithFullBuilderSpecification) {
 
   std::string pattern = "\"C(a, b, c) += A(a, c, d) * B(d, b)\"";
   std::string builder1 = "transposeBuilder<Inputs<[\"C\"]>, "
-                         "Outputs<[\"D\"]>, StrExpr<\"{0,2,1}\">>,";
-  std::string builder2 = "reshapeBuilder<Inputs<[\"D\"]>, Outputs<[\"E\"]>, "
-                         "StrExpr<\"{{0, 1}, 2}\">>,";
-  std::string builder3 = "reshapeBuilder<Inputs<[\"A\"]>, Outputs<[\"F\"]>, "
-                         "StrExpr<\"{{0, 1}, 2}\">>,";
+                         "Outputs<[\"D\"]>, StrExpr<\"{0,2,1}\">, "
+                         "Parallel<[\"a\",\"c\",\"b\"]>, Reduction<[]>>,";
+  std::string builder2 = "reshapeViewBuilder<Inputs<[\"D\"]>, Outputs<[\"E\"]>, "
+                         "StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"f\",\"b\"]>, Reduction<[]>>,";
+  std::string builder3 = "reshapeViewBuilder<Inputs<[\"A\"]>, Outputs<[\"F\"]>, "
+                         "StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"f\",\"d\"]>, Reduction<[]>>,";
   std::string builder4 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"F\",\"B\"]>, "
-      "Outputs<[\"E\"]>>,";
-  std::string builder5 = "reshapeBuilder<Inputs<[\"E\"]>, Outputs<[\"tmp2\"]>, "
-                         "StrExpr<\"{{0, 1}, 2}\">>,";
-  std::string builder6 = "transposeBuilder<Inputs<[\"tmp2\"]>, "
-                         "Outputs<[\"C\"]>, StrExpr<\"{0,2,1}\">>,";
-  std::string builder7 = "eraseOpBuilder";
+      "Outputs<[\"E\"]>, Parallel<[\"f\",\"b\"]>, Reduction<[\"d\"]>>,";
+  std::string builder5 = "permuteReshapeBuilder<Inputs<[\"E\"]>, "
+                         "Outputs<[\"C\"]>, StrExpr<\"{0,2,1}\">, "
+                         "StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"a\",\"b\",\"c\"]>, Reduction<[]>>,";
+  std::string builder6 = "eraseOpBuilder";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -151,7 +137,6 @@ TEST(DslTest, tensorWithFullBuilderSpecification) {
   auto builder4Pos = res.find(builder4);
   auto builder5Pos = res.find(builder5);
   auto builder6Pos = res.find(builder6);
-  auto builder7Pos = res.find(builder7);
 
   ASSERT_TRUE(patternPos != std::string::npos);
   ASSERT_TRUE(builder1Pos != std::string::npos);
@@ -160,7 +145,6 @@ TEST(DslTest, tensorWithFullBuilderSpecification) {
   ASSERT_TRUE(builder4Pos != std::string::npos);
   ASSERT_TRUE(builder5Pos != std::string::npos);
   ASSERT_TRUE(builder6Pos != std::string::npos);
-  ASSERT_TRUE(builder7Pos != std::string::npos);
 }
 
 // Check Gemm
@@ -183,7 +167,7 @@ TEST(DslTest, checkGemmCall) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -212,7 +196,7 @@ TEST(DslTest, shouldBeLoweredToAStrExprposeGemmCallForB) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -241,7 +225,7 @@ TEST(DslTest, shouldBeLoweredToAStrExprposeGemmCallForA) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"T\">, StrExpr<\"N\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -270,7 +254,7 @@ TEST(DslTest, shouldBeLoweredToAStrExprposeGemmCallForAandB) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"T\">, StrExpr<\"T\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -299,7 +283,7 @@ TEST(DslTest, shouldHaveBetaSetToZero) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -332,7 +316,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase1) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<2>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -363,7 +347,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase2) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<1>, N<2>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -394,7 +378,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase3) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"T\">, StrExpr<\"N\">, M<1>, N<2>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -425,7 +409,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase4) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"T\">, StrExpr<\"T\">, M<1>, N<2>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -456,7 +440,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase5) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"T\">, StrExpr<\"T\">, M<2>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"B\",\"A\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -487,7 +471,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase6) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<2>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"B\",\"A\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -518,7 +502,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase7) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"T\">, StrExpr<\"N\">, M<2>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"B\",\"A\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -549,7 +533,7 @@ TEST(DslTest, shouldBeLoweredToASingleGemmCallCase8) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<2>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"B\",\"A\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -583,16 +567,18 @@ TEST(DslTest, shouldBeLoweredToAGemmCallAndMultipleReshapes) {
   S.str();
 
   std::string pattern = "\"C(m, n, p) += A(m, k) * B(k, n, p)\"";
-  std::string builder1 = "reshapeBuilder<Inputs<[\"C\"]>, Outputs<[\"D\"]>, "
-                         "StrExpr<\"{0, {1, 2}}\">>,";
-  std::string builder2 = "reshapeBuilder<Inputs<[\"B\"]>, Outputs<[\"E\"]>, "
-                         "StrExpr<\"{0, {1, 2}}\">>,";
+  std::string builder1 = "reshapeViewBuilder<Inputs<[\"C\"]>, Outputs<[\"D\"]>, "
+                         "StrExpr<\"{0, {1, 2}}\">, "
+                         "Parallel<[\"m\",\"f\"]>, Reduction<[]>>,";
+  std::string builder2 = "reshapeViewBuilder<Inputs<[\"B\"]>, Outputs<[\"E\"]>, "
+                         "StrExpr<\"{0, {1, 2}}\">, "
+                         "Parallel<[\"k\",\"f\"]>, Reduction<[]>>,";
   std::string builder3 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"E\"]>, "
-      "Outputs<[\"D\"]>>,";
-  std::string builder4 = "reshapeBuilder<Inputs<[\"D\"]>, Outputs<[\"C\"]>, "
-                         "StrExpr<\"{0, {1, 2}}\">>,";
+      "Outputs<[\"D\"]>, Parallel<[\"m\",\"f\"]>, Reduction<[\"k\"]>>,";
+  // D is a view of C, the write-back is elided.
+  std::string builder4 = "reshapeBuilder<Inputs<[\"D\"]>, Outputs<[\"C\"]>, ";
   std::string builder5 = "eraseOpBuilder";
 
   auto patternPos = res.find(pattern);
@@ -606,7 +592,7 @@ TEST(DslTest, shouldBeLoweredToAGemmCallAndMultipleReshapes) {
   ASSERT_TRUE(builder1Pos != std::string::npos);
   ASSERT_TRUE(builder2Pos != std::string::npos);
   ASSERT_TRUE(builder3Pos != std::string::npos);
-  ASSERT_TRUE(builder4Pos != std::string::npos);
+  ASSERT_TRUE(builder4Pos == std::string::npos);
   ASSERT_TRUE(builder5Pos != std::string::npos);
 }
 
@@ -657,7 +643,7 @@ TEST(DslTest, shouldLowerToGemm) {
   std::string builder1 =
       "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
       "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-      "Outputs<[\"C\"]>>,";
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
 
   auto patternPos = res.find(pattern);
   auto builder1Pos = res.find(builder1);
@@ -690,7 +676,8 @@ TEST(DslTest, shouldLowerToMatVec) {
 	std::string pattern = "\"x(i) += A(i, j) * y(j)\"";
 	std::string builder1 =
 			"matvecBuilder<StrExpr<\"N\">, Inputs<[\"A\",\"y\"]>, Outputs<[\"x\"]>, " 
-			"Constant<\"1\">, Constant<\"1\">>,";
+			"Constant<\"1\">, Constant<\"1\">, "
+			"Parallel<[\"i\"]>, Reduction<[\"j\"]>>,";
 	
 	auto patternPos = res.find(pattern);
 	auto builder1Pos = res.find(builder1);
@@ -717,7 +704,8 @@ TEST(DslTest, shouldLowerToMatVecTrans) {
 	std::string pattern = "\"x(i) += A(j, i) * y(j)\"";
 	std::string builder1 =
 			"matvecBuilder<StrExpr<\"T\">, Inputs<[\"A\",\"y\"]>, Outputs<[\"x\"]>, " 
-			"Constant<\"1\">, Constant<\"1\">>,";
+			"Constant<\"1\">, Constant<\"1\">, "
+			"Parallel<[\"i\"]>, Reduction<[\"j\"]>>,";
 	
 	auto patternPos = res.find(pattern);
 	auto builder1Pos = res.find(builder1);
@@ -744,7 +732,8 @@ TEST(DslTest, shouldLowerToMatVecWithConstantAlpha) {
 	std::string pattern = "\"x(i) += alpha * A(i, j) * y(j)\"";
 	std::string builder1 =
       "matvecBuilder<StrExpr<\"N\">, Inputs<[\"A\",\"y\"]>, Outputs<[\"x\"]>, "
-      "Constant<\"alpha\">, Constant<\"1\">>,";	
+      "Constant<\"alpha\">, Constant<\"1\">, "
+      "Parallel<[\"i\"]>, Reduction<[\"j\"]>>,";	
 	
 	auto patternPos = res.find(pattern);
 	auto builder1Pos = res.find(builder1);
@@ -771,7 +760,8 @@ TEST(DslTest, shouldLowerToMatVecWithConstantAlphaTranspose) {
 	std::string pattern = "\"x(i) += alpha * A(j, i) * y(j)\"";
 	std::string builder1 =
       "matvecBuilder<StrExpr<\"T\">, Inputs<[\"A\",\"y\"]>, Outputs<[\"x\"]>, "
-      "Constant<\"alpha\">, Constant<\"1\">>,";	
+      "Constant<\"alpha\">, Constant<\"1\">, "
+      "Parallel<[\"i\"]>, Reduction<[\"j\"]>>,";	
 	
 	auto patternPos = res.find(pattern);
 	auto builder1Pos = res.find(builder1);
@@ -796,7 +786,8 @@ TEST(DslTest, shouldLowerToConv) {
 	S.str();
 	std::string pattern = "\"out(out_h, out_w) += filt(k_h, k_w) * image(out_h + k_h, out_w + k_w)\"";
 	std::string builder1 = 
-		"convBuilder<Inputs<[\"filt\", \"image\"]>, Outputs<[\"out\"]>, StrExpr<\"{1, 1, 1, 1}\">, StrExpr<\"{0, 0}\">>,";
+		"convBuilder<Inputs<[\"filt\", \"image\"]>, Outputs<[\"out\"]>, StrExpr<\"{1, 1, 1, 1}\">, StrExpr<\"{0, 0}\">, "
+		"Parallel<[\"out_h\",\"out_w\"]>, Reduction<[\"k_h\",\"k_w\"]>>,";
 	
 	auto patternPos = res.find(pattern);
 	auto builder1Pos = res.find(builder1);
@@ -837,10 +828,12 @@ TEST(DslTest, shouldLowerToTTGTDec) {
 	emitTactic(p, S);
 	S.str();
 
-	std::string builder1 = "reshapeBuilder<Inputs<[\"C\"]>, Outputs<[\"tmp2\"]>," 
-		" StrExpr<\"{{0, 1}, 2, 3}\">>,";
-	std::string builder2 = "reshapeBuilder<Inputs<[\"tmp2\"]>, Outputs<[\"tmp3\"]>," 
-		" StrExpr<\"{0, {1, 2}}\">>,";
+	std::string builder1 = "reshapeViewBuilder<Inputs<[\"C\"]>, Outputs<[\"tmp2\"]>," 
+		" StrExpr<\"{{0, 1}, 2, 3}\">, "
+		"Parallel<[\"i\",\"c\",\"d\"]>, Reduction<[]>>,";
+	std::string builder2 = "reshapeViewBuilder<Inputs<[\"tmp2\"]>, Outputs<[\"tmp3\"]>," 
+		" StrExpr<\"{0, {1, 2}}\">, "
+		"Parallel<[\"i\",\"j\"]>, Reduction<[]>>,";
 	
 	auto builder1Pos = res.find(builder1);
 	auto builder2Pos = res.find(builder2);
@@ -867,7 +860,8 @@ TEST(DslTest, shoudlLowerToGemmWithAlpha) {
 		
 	std::string builder = "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, "
 		"N<1>, K<1>, Constant<\"alpha\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
-		"Outputs<[\"C\"]>>,";
+		"Outputs<[\"C\"]>, "
+		"Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
 
 	auto builderPos = res.find(builder);
 	
@@ -897,14 +891,21 @@ TEST(DslTest, should) {
 	emitTactic(p, S);
 	S.str();
 
-	std::string builder = "transposeBuilder<Inputs<[\"A\"]>, Outputs<[\"tmp0\"]>, StrExpr<\"{0,2,1,3}\">>,";
-	std::string builder1 = "transposeBuilder<Inputs<[\"B\"]>, Outputs<[\"tmp1\"]>, StrExpr<\"{3,1,2,0}\">>,";
-	std::string builder2 = "reshapeBuilder<Inputs<[\"C\"]>, Outputs<[\"tmp2\"]>, StrExpr<\"{{0, 1}{2, 3}}\">>,";
-  std::string builder3 = "reshapeBuilder<Inputs<[\"tmp0\"]>, Outputs<[\"tmp3\"]>, StrExpr<\"{{0, 1}{2, 3}}\">>,";
-  std::string builder4 = "reshapeBuilder<Inputs<[\"tmp1\"]>, Outputs<[\"tmp4\"]>, StrExpr<\"{{0, 1}{2, 3}}\">>,";
+	std::string builder = "transposeBuilder<Inputs<[\"A\"]>, Outputs<[\"tmp0\"]>, StrExpr<\"{0,2,1,3}\">, "
+	                      "Parallel<[\"a\",\"b\",\"e\",\"f\"]>, Reduction<[]>>,";
+	std::string builder1 = "transposeBuilder<Inputs<[\"B\"]>, Outputs<[\"tmp1\"]>, StrExpr<\"{3,1,2,0}\">, "
+	                       "Parallel<[\"e\",\"f\",\"c\",\"d\"]>, Reduction<[]>>,";
+	std::string builder2 = "reshapeViewBuilder<Inputs<[\"C\"]>, Outputs<[\"tmp2\"]>, StrExpr<\"{{0, 1}, {2, 3}}\">, "
+	                       "Parallel<[\"i\",\"j\"]>, Reduction<[]>>,";
+  std::string builder3 = "reshapeViewBuilder<Inputs<[\"tmp0\"]>, Outputs<[\"tmp3\"]>, StrExpr<\"{{0, 1}, {2, 3}}\">, "
+                         "Parallel<[\"i\",\"k\"]>, Reduction<[]>>,";
+  std::string builder4 = "reshapeViewBuilder<Inputs<[\"tmp1\"]>, Outputs<[\"tmp4\"]>, StrExpr<\"{{0, 1}, {2, 3}}\">, "
+                         "Parallel<[\"k\",\"j\"]>, Reduction<[]>>,";
   std::string builder5 = "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, K<1>, Constant<\"1\">, "
-		"Constant<\"1\">, Inputs<[\"tmp3\",\"tmp4\"]>, Outputs<[\"tmp2\"]>>,";
-  std::string builder6 = "reshapeBuilder<Inputs<[\"tmp2\"]>, Outputs<[\"C\"]>, StrExpr<\"{{0, 1}{2, 3}}\">>,";
+		"Constant<\"1\">, Inputs<[\"tmp3\",\"tmp4\"]>, Outputs<[\"tmp2\"]>, "
+		"Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  std::string builder6 = "reshapeBuilder<Inputs<[\"tmp2\"]>, Outputs<[\"C\"]>, StrExpr<\"{{0, 1}, {2, 3}}\">, "
+                         "Parallel<[\"a\",\"b\",\"c\",\"d\"]>, Reduction<[]>>,";
 
 	auto builder1Pos = res.find(builder1);
 	auto builder2Pos = res.find(builder2);
@@ -918,5 +919,1464 @@ TEST(DslTest, should) {
 	ASSERT_TRUE(builder3Pos != std::string::npos);
 	ASSERT_TRUE(builder4Pos != std::string::npos);
 	ASSERT_TRUE(builder5Pos != std::string::npos);
-	ASSERT_TRUE(builder6Pos != std::string::npos);
+	// tmp2 is a view of C, the GEMM already wrote the result in place.
+	ASSERT_TRUE(builder6Pos == std::string::npos);
+}
+
+// D is dead after the second transpose, G has the same size and reuses it.
+TEST(DslTest, shouldReuseDeadTemporaries) {
+
+  std::string raw = R"(
+  def TRANSPOSE {
+    what
+    C(a, b, c) = A(c, b, a)
+    how
+    D(b, c, a) = A(c, b, a)
+    E(a, c, b) = D(b, c, a)
+    G(c, a, b) = E(a, c, b)
+    C(a, b, c) = G(c, a, b)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string footprint = "// Peak intermediate footprint: a*b*c + a*b*c "
+                          "elements in 2 buffers";
+  std::string builder1 = "transposeBuilder<Inputs<[\"E\"]>, "
+                         "Outputs<[\"D\"]>, StrExpr<\"{1,0,2}\">, "
+                         "Parallel<[\"c\",\"a\",\"b\"]>, Reduction<[]>>,";
+  std::string builder2 = "transposeBuilder<Inputs<[\"D\"]>, "
+                         "Outputs<[\"C\"]>, StrExpr<\"{1,2,0}\">, "
+                         "Parallel<[\"a\",\"b\",\"c\"]>, Reduction<[]>>,";
+
+  auto footprintPos = res.find(footprint);
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+
+  ASSERT_TRUE(footprintPos != std::string::npos);
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(res.find("\"G\"") == std::string::npos);
+}
+
+// Reshapes of adjacent dimensions into fresh temporaries are views, only
+// the transpose of C needs a buffer.
+TEST(DslTest, shouldLowerContiguousReshapesToViews) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a, b, c) += A(a, c, d) * B(d, b)
+    how
+    D(a, c, b) = C(a, b, c)
+    E(f, b) = D(a, c, b) where f = a * c
+    F(f, d) = A(a, c, d) where f = a * c
+    E(f, b) += F(f, d) * B(d, b)
+    G(a, c, b) = E(f, b) where f = a * c
+    C(a, b, c) = G(a, c, b)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string footprint =
+      "// Peak intermediate footprint: a*b*c elements in 1 buffer";
+  std::string builder1 = "reshapeViewBuilder<Inputs<[\"D\"]>, "
+                         "Outputs<[\"E\"]>, StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"f\",\"b\"]>, Reduction<[]>>,";
+  std::string builder2 = "reshapeViewBuilder<Inputs<[\"A\"]>, "
+                         "Outputs<[\"F\"]>, StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"f\",\"d\"]>, Reduction<[]>>,";
+  std::string builder3 = "reshapeViewBuilder<Inputs<[\"E\"]>, "
+                         "Outputs<[\"G\"]>, StrExpr<\"{{0, 1}, 2}\">, "
+                         "Parallel<[\"a\",\"c\",\"b\"]>, Reduction<[]>>,";
+
+  auto footprintPos = res.find(footprint);
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+  auto builder3Pos = res.find(builder3);
+
+  ASSERT_TRUE(footprintPos != std::string::npos);
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(builder3Pos != std::string::npos);
+}
+
+TEST(DslTest, shouldCopyReshapesOfOperandsWrittenLater) {
+
+  std::string raw = R"(
+  def SCAL {
+    what
+    y(a, c) = alpha * x(a, c)
+    how
+    v(f) = x(a, c) where f = a * c
+    v(f) = alpha * v(f)
+    y(a, c) = v(f) where f = a * c
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // a view of "x" would let the scal overwrite the caller's tensor.
+  std::string builder1 = "reshapeBuilder<Inputs<[\"x\"]>, "
+                         "Outputs<[\"v\"]>, StrExpr<\"{{0, 1}}\">, "
+                         "Parallel<[\"f\"]>, Reduction<[]>>,";
+  std::string builder2 = "scalBuilder<Inputs<[\"v\"]>, "
+                         "Outputs<[\"v\"]>, Constant<\"alpha\">, "
+                         "Parallel<[\"f\"]>, Reduction<[]>>,";
+
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(builder1Pos < builder2Pos);
+  ASSERT_TRUE(res.find("reshapeViewBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToBatchedGemm) {
+
+  std::string raw = R"(
+  def BGEMM {
+    what = how
+    C(b, i, j) += A(b, i, k) * B(b, k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "batchedMatmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, Batch<1>, "
+      "StrExpr<\"{{0}, {0}, {0}}\">, Constant<\"1\">, Constant<\"1\">, "
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"b\",\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToStridedBatchedGemm) {
+
+  std::string raw = R"(
+  def BGEMM {
+    what = how
+    C(i, b, j) += alpha * (A(k, b, i) * B(j, k, b))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "batchedMatmulBuilder<StrExpr<\"T\">, StrExpr<\"T\">, Batch<1>, "
+      "StrExpr<\"{{1}, {2}, {1}}\">, Constant<\"alpha\">, Constant<\"1\">, "
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"i\",\"b\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("reshape") == std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToGemmWithGroupedDimensions) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(a, b, c, d) += A(e, f, a, b) * B(c, d, e, f)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "matmulBuilder<StrExpr<\"T\">, StrExpr<\"T\">, M<2>, N<2>, "
+      "K<2>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, "
+      "Parallel<[\"a\",\"b\",\"c\",\"d\"]>, Reduction<[\"e\",\"f\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToStridedConv) {
+
+  std::string raw = R"(
+  def CONV {
+    what = how
+    out(n, o, h, w) += filt(o, c, kh, kw) * image(n, c, 2*h + 3*kh - 1, w + kw)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "convBuilder<Inputs<[\"filt\", \"image\"]>, Outputs<[\"out\"]>, "
+      "StrExpr<\"{2, 1, 3, 1}\">, StrExpr<\"{1, 0}\">, StrExpr<\"NCHW\">, "
+      "Parallel<[\"n\",\"o\",\"h\",\"w\"]>, Reduction<[\"c\",\"kh\",\"kw\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToConvWithChannelsLast) {
+
+  std::string raw = R"(
+  def CONV {
+    what = how
+    out(n, h, w, o) += image(n, 2*h + kh - 1, 2*w + kw - 1, c) * filt(kh, kw, c, o)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "convBuilder<Inputs<[\"filt\", \"image\"]>, Outputs<[\"out\"]>, "
+      "StrExpr<\"{2, 2, 1, 1}\">, StrExpr<\"{1, 1}\">, StrExpr<\"NHWC\">, "
+      "Parallel<[\"n\",\"h\",\"w\",\"o\"]>, Reduction<[\"kh\",\"kw\",\"c\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToConvWithSymbolicStrides) {
+
+  std::string raw = R"(
+  def CONV {
+    what = how
+    out(n, o, h, w) += filt(o, c, kh, kw) * image(n, c, s*h + d*kh - 1, s*w + kw)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "convBuilder<Inputs<[\"filt\", \"image\"]>, Outputs<[\"out\"]>, "
+      "StrExpr<\"{s, s, d, 1}\">, StrExpr<\"{1, 0}\">, StrExpr<\"NCHW\">, "
+      "Parallel<[\"n\",\"o\",\"h\",\"w\"]>, Reduction<[\"c\",\"kh\",\"kw\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerConvWithFewChannelsToIm2col) {
+
+  std::string raw = R"(
+  def CONV {
+    what = how
+    out(k, p, q) += filt(k, c, r, s) * image(c, p + r - 1, q + s - 1)
+      where c in 0:3, r in 0:3, s in 0:3, p in 0:56, q in 0:56
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder1 =
+      "im2colBuilder<Inputs<[\"image\"]>, Outputs<[\"tmp0\"]>, "
+      "StrExpr<\"{1, 1, 1, 1}\">, StrExpr<\"{1, 1}\">, StrExpr<\"CHW\">, "
+      "StrExpr<\"CRSPQ\">, "
+      "Parallel<[\"c\",\"r\",\"s\",\"p\",\"q\"]>, Reduction<[]>>,";
+  std::string builder2 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<2>, "
+      "K<3>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"filt\",\"tmp0\"]>, "
+      "Outputs<[\"out\"]>, "
+      "Parallel<[\"k\",\"p\",\"q\"]>, Reduction<[\"c\",\"r\",\"s\"]>>,";
+
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(builder1Pos < builder2Pos);
+}
+
+TEST(DslTest, shouldLowerConvWithManyChannelsToDirectConv) {
+
+  std::string raw = R"(
+  def CONV {
+    what = how
+    out(k, p, q) += filt(k, c, r, s) * image(c, p + r - 2, q + s - 2)
+      where c in 0:64, r in 0:5, s in 0:5, p in 0:56, q in 0:56
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "convBuilder<Inputs<[\"filt\", \"image\"]>, Outputs<[\"out\"]>, "
+      "StrExpr<\"{1, 1, 1, 1}\">, StrExpr<\"{2, 2}\">, StrExpr<\"CHW\">, "
+      "Parallel<[\"k\",\"p\",\"q\"]>, Reduction<[\"c\",\"r\",\"s\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("im2colBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldLowerConv3x3ToWinograd) {
+
+  std::string raw = R"(
+  def CONV {
+    what = how
+    out(k, p, q) += filt(k, c, r, s) * image(c, p + r - 1, q + s - 1)
+      where c in 0:64, r in 0:3, s in 0:3, p in 0:56, q in 0:56
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder1 =
+      "winogradFilterTransformBuilder<Inputs<[\"filt\"]>, "
+      "Outputs<[\"tmp0\"]>, StrExpr<\"F(4x4, 3x3)\">, StrExpr<\"KCRS\">, "
+      "Hoistable<1>, Parallel<[\"k\",\"c\",\"r\",\"s\"]>, Reduction<[]>>,";
+  std::string builder2 =
+      "winogradInputTransformBuilder<Inputs<[\"image\"]>, "
+      "Outputs<[\"tmp1\"]>, StrExpr<\"F(4x4, 3x3)\">, StrExpr<\"{1, 1}\">, "
+      "StrExpr<\"CHW\">, Parallel<[\"p\",\"q\",\"c\"]>, Reduction<[]>>,";
+  std::string builder3 =
+      "batchedMatmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, Batch<1>, "
+      "StrExpr<\"{{0}, {0}, {0}}\">, Constant<\"1\">, Constant<\"1\">, "
+      "Inputs<[\"tmp0\",\"tmp1\"]>, Outputs<[\"tmp2\"]>, "
+      "Parallel<[\"k\",\"p\",\"q\"]>, Reduction<[\"c\"]>>,";
+  std::string builder4 =
+      "winogradOutputTransformBuilder<Inputs<[\"tmp2\"]>, "
+      "Outputs<[\"out\"]>, StrExpr<\"F(4x4, 3x3)\">, StrExpr<\"KPQ\">, "
+      "Parallel<[\"k\",\"p\",\"q\"]>, Reduction<[]>>,";
+
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+  auto builder3Pos = res.find(builder3);
+  auto builder4Pos = res.find(builder4);
+
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(builder3Pos != std::string::npos);
+  ASSERT_TRUE(builder4Pos != std::string::npos);
+  ASSERT_TRUE(builder3Pos < builder4Pos);
+}
+
+TEST(DslTest, shouldLowerMatrixChainInCheapestOrder) {
+
+  std::string raw = R"(
+  def CHAIN {
+    what = how
+    D(i, l) += A(i, j) * B(j, k) * C(k, l)
+      where i in 0:1000, j in 0:1000, k in 0:1000, l in 0:10
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder1 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"0\">, Inputs<[\"B\",\"C\"]>, "
+      "Outputs<[\"tmp0\"]>, Parallel<[\"j\",\"l\"]>, Reduction<[\"k\"]>>,";
+  std::string builder2 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"tmp0\"]>, "
+      "Outputs<[\"D\"]>, Parallel<[\"i\",\"l\"]>, Reduction<[\"j\"]>>,";
+
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(builder1Pos < builder2Pos);
+}
+
+TEST(DslTest, shouldLowerContractionOfFourOperands) {
+
+  std::string raw = R"(
+  def CHAIN {
+    what = how
+    E(m, i) += A(i, j) * B(k, j) * C(k, l) * D(l, m)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string footprint =
+      "// Peak intermediate footprint: i*k + i*l elements in 2 buffers";
+  std::string builder1 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"0\">, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"tmp0\"]>, Parallel<[\"i\",\"k\"]>, Reduction<[\"j\"]>>,";
+  std::string builder2 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"0\">, Inputs<[\"tmp0\",\"C\"]>, "
+      "Outputs<[\"tmp1\"]>, Parallel<[\"i\",\"l\"]>, Reduction<[\"k\"]>>,";
+  std::string builder3 =
+      "matmulBuilder<StrExpr<\"T\">, StrExpr<\"T\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"D\",\"tmp1\"]>, "
+      "Outputs<[\"E\"]>, Parallel<[\"m\",\"i\"]>, Reduction<[\"l\"]>>,";
+
+  ASSERT_TRUE(res.find(footprint) != std::string::npos);
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+  ASSERT_TRUE(res.find(builder3) != std::string::npos);
+}
+
+TEST(DslTest, shouldFuseBiasAndActivationInGemmEpilogue) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(i, j) = max(2 * tanh(A(i, k) * B(k, j) + bias(j)), 0)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"0\">, "
+      "Inputs<[\"A\",\"B\",\"bias\"]>, Outputs<[\"C\"]>, "
+      "Epilogue<\"max(2 * tanh(%acc + bias(j)), 0)\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldFuseScalingInGemmEpilogue) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(i, j) = (A(k, i) * B(k, j)) / s
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "matmulBuilder<StrExpr<\"T\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"0\">, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, Epilogue<\"%acc / s\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldFuseNegationInGemmEpilogue) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(i, j) = -(A(i, k) * B(k, j) + bias(j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "Inputs<[\"A\",\"B\",\"bias\"]>, Outputs<[\"C\"]>, "
+      "Epilogue<\"-(%acc + bias(j))\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+// The += reduces the whole rhs, the bias would be added once per k.
+TEST(DslTest, shouldNotFuseEpilogueInAccumulatingGemm) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(i, j) += A(i, k) * B(k, j) + bias(j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+}
+
+TEST(DslTest, shouldFuseElementwiseChains) {
+
+  std::string raw = R"(
+  def EW {
+    what
+    U(i, j) = exp(A(i, j) + B(i, j)) * V(j, i)
+    how
+    T(i, j) = A(i, j) + B(i, j)
+    W(j, i) = exp(T(i, j))
+    U(i, j) = W(j, i) * V(j, i)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string footprint = "// Peak intermediate footprint: 0 elements";
+  std::string builder =
+      "elementwiseBuilder<Inputs<[\"A\",\"B\",\"V\"]>, Outputs<[\"U\"]>, "
+      "StrExpr<\"U(i, j) = exp(A(i, j) + B(i, j)) * V(j, i)\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[]>>,";
+
+  ASSERT_TRUE(res.find(footprint) != std::string::npos);
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find(builder) == res.rfind("elementwiseBuilder"));
+}
+
+TEST(DslTest, shouldMaterializeElementwiseChainFeedingGemm) {
+
+  std::string raw = R"(
+  def EW {
+    what
+    C(i, j) += A(i, k) * s * B(k, j)
+    how
+    T(i, k) = A(i, k) * s
+    S(i, k) = exp(T(i, k))
+    C(i, j) += S(i, k) * B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string footprint =
+      "// Peak intermediate footprint: i*k elements in 1 buffer";
+  std::string builder1 =
+      "elementwiseBuilder<Inputs<[\"A\"]>, Outputs<[\"S\"]>, "
+      "StrExpr<\"S(i, k) = exp(A(i, k) * s)\">, "
+      "Parallel<[\"i\",\"k\"]>, Reduction<[]>>,";
+  std::string builder2 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"S\",\"B\"]>, "
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+
+  ASSERT_TRUE(res.find(footprint) != std::string::npos);
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToDot) {
+
+  std::string raw = R"(
+  def DOT {
+    what = how
+    s += x(i) * y(i)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "dotBuilder<Inputs<[\"x\",\"y\"]>, Outputs<[\"s\"]>, "
+      "Parallel<[]>, Reduction<[\"i\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToAxpy) {
+
+  std::string raw = R"(
+  def AXPY {
+    what = how
+    y(i) += alpha * x(i)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder = "axpyBuilder<Inputs<[\"x\"]>, Outputs<[\"y\"]>, "
+                        "Constant<\"alpha\">, "
+                        "Parallel<[\"i\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToScal) {
+
+  std::string raw = R"(
+  def SCAL {
+    what
+    x(i) = alpha * x(i)
+    how
+    x(i) = alpha * x(i)
+    x(i) *= 2
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder1 = "scalBuilder<Inputs<[\"x\"]>, Outputs<[\"x\"]>, "
+                         "Constant<\"alpha\">, "
+                         "Parallel<[\"i\"]>, Reduction<[]>>,";
+  std::string builder2 = "scalBuilder<Inputs<[\"x\"]>, Outputs<[\"x\"]>, "
+                         "Constant<\"2\">, Parallel<[\"i\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToSyrk) {
+
+  std::string raw = R"(
+  def SYRK {
+    what = how
+    C(i, j) += alpha * (A(k, i) * A(k, j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "syrkBuilder<StrExpr<\"L\">, StrExpr<\"T\">, Constant<\"alpha\">, "
+      "Constant<\"1\">, Inputs<[\"A\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("matmulBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToSyr2k) {
+
+  std::string raw = R"(
+  def SYR2K {
+    what = how
+    C(i, j) += A(i, k) * B(j, k) + B(i, k) * A(j, k)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "syr2kBuilder<StrExpr<\"L\">, StrExpr<\"N\">, Constant<\"1\">, "
+      "Constant<\"1\">, Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToGer) {
+
+  std::string raw = R"(
+  def GER {
+    what = how
+    C(i, j) += x(i) * y(j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder = "gerBuilder<Inputs<[\"x\",\"y\"]>, Outputs<[\"C\"]>, "
+                        "Constant<\"1\">, "
+                        "Parallel<[\"i\",\"j\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToGerWithAlpha) {
+
+  std::string raw = R"(
+  def GER {
+    what = how
+    C(i, j) += alpha * x(j) * y(i)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder = "gerBuilder<Inputs<[\"y\",\"x\"]>, Outputs<[\"C\"]>, "
+                        "Constant<\"alpha\">, "
+                        "Parallel<[\"i\",\"j\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToMinPlusMatMul) {
+
+  std::string raw = R"(
+  def SEMIRING {
+    what = how
+    C(i, j) min= A(i, k) + B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "semiringMatmulBuilder<StrExpr<\"min-plus\">, StrExpr<\"N\">, "
+      "StrExpr<\"N\">, M<1>, N<1>, K<1>, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("C(i, j) min= A(i, k) + B(k, j)") != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToMaxTimesMatMulWithTranspose) {
+
+  std::string raw = R"(
+  def SEMIRING {
+    what = how
+    C(i, j) max= A(k, i) * B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "semiringMatmulBuilder<StrExpr<\"max-times\">, StrExpr<\"T\">, "
+      "StrExpr<\"N\">, M<1>, N<1>, K<1>, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToBitPackedBooleanMatMul) {
+
+  std::string raw = R"(
+  def CLOSURE {
+    what = how
+    C(i, j) max= A(i, k) && B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "booleanMatmulBuilder<StrExpr<\"or-and\">, StrExpr<\"N\">, "
+      "StrExpr<\"N\">, M<1>, N<1>, K<1>, Packing<64>, "
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("C(i, j) max= A(i, k) && B(k, j)") != std::string::npos);
+}
+
+TEST(DslTest, shouldNotPackFloatOperandsOfBooleanSemiring) {
+
+  std::string raw = R"(
+  def CLOSURE(float A, float B) {
+    what = how
+    C(i, j) max= A(i, k) && B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "semiringMatmulBuilder<StrExpr<\"or-and\">, StrExpr<\"N\">, "
+      "StrExpr<\"N\">, M<1>, N<1>, K<1>, "
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("Packing<64>") == std::string::npos);
+}
+
+TEST(DslTest, shouldNotLowerMinOverAndToBooleanMatMul) {
+
+  std::string raw = R"(
+  def CLOSURE {
+    what = how
+    C(i, j) min= A(i, k) && B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+}
+
+TEST(DslTest, shouldEmitMixedPrecisionMatMul) {
+
+  std::string raw = R"(
+  def GEMM(bfloat16(M, K) A, bfloat16(K, N) B, float16(M, N) C) {
+    what = how
+    C(i, j) += A(i, k) * B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, K<1>, "
+      "Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, InputType<\"bf16\">, AccumulatorType<\"f32\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldRejectMatMulWithMismatchedInputTypes) {
+
+  std::string raw = R"(
+  def GEMM(float16 A, float B) {
+    what = how
+    C(i, j) += A(i, k) * B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+}
+
+TEST(DslTest, shouldLowerToQuantizedMatMul) {
+
+  std::string raw = R"(
+  def QGEMM {
+    what = how
+    C(i, j) += int32(A(i, k)) * int32(B(k, j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "quantizedMatmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, ZeroPoints<\"0\", \"0\">, "
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, AccumulatorType<\"i32\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldLowerToQuantizedMatMulWithRequantization) {
+
+  std::string raw = R"(
+  def QGEMM(int8 A, int8 B, int8 C) {
+    what = how
+    C(i, j) = int8((int32(A(i, k)) - za) * (int32(B(j, k)) - 3) * scale(j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "quantizedMatmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<1>, N<1>, "
+      "K<1>, Constant<\"0\">, ZeroPoints<\"za\", \"3\">, "
+      "Inputs<[\"A\",\"B\",\"scale\"]>, Outputs<[\"C\"]>, "
+      "AccumulatorType<\"i32\">, Epilogue<\"int8(%acc * scale(j))\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldNotRequantizeAccumulatingQuantizedMatMul) {
+
+  std::string raw = R"(
+  def QGEMM(int8 A, int8 B, int8 C) {
+    what = how
+    C(i, j) += int8(int32(A(i, k)) * int32(B(k, j)) * scale(j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+  ASSERT_TRUE(res.find("quantizedMatmulBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldNotTakeUnaryMinusForAZeroPoint) {
+
+  std::string raw = R"(
+  def QGEMM {
+    what = how
+    C(i, j) += -int32(A(i, k)) * int32(B(k, j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+}
+
+TEST(DslTest, shouldNotLowerFloatOperandsToQuantizedMatMul) {
+
+  std::string raw = R"(
+  def QGEMM(float A, int8 B) {
+    what = how
+    C(i, j) += int32(A(i, k)) * int32(B(k, j))
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+  ASSERT_TRUE(res.find("quantizedMatmulBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldLowerSparseOperandToSpMM) {
+
+  std::string raw = R"(
+  def SPMM(float(M, K) A : csr, float(K, N) B) {
+    what = how
+    C(i, j) += A(i, k) * B(k, j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "spmmBuilder<SparseOperand<\"A\", \"csr\">, StrExpr<\"N\">, "
+      "StrExpr<\"N\">, Constant<\"1\">, Constant<\"1\">, "
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"C\"]>, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+  ASSERT_TRUE(res.find("matmulBuilder<") == std::string::npos);
+}
+
+TEST(DslTest, shouldNotLowerSparseOperandToSyrk) {
+
+  std::string raw = R"(
+  def SYRK(float(M, K) A : csr) {
+    what = how
+    C(i, j) += A(i, k) * A(j, k)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  // spmm expects a single sparse operand.
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+  ASSERT_TRUE(res.find("syrkBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldLowerSparseOperandToSpMV) {
+
+  std::string raw = R"(
+  def SPMV(A : coo) {
+    what = how
+    x(i) += A(j, i) * y(j)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "spmvBuilder<SparseOperand<\"A\", \"coo\">, StrExpr<\"T\">, "
+      "Inputs<[\"A\",\"y\"]>, Outputs<[\"x\"]>, Constant<\"1\">, "
+      "Constant<\"1\">, Parallel<[\"i\"]>, Reduction<[\"j\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldEmitCacheTilesForMatMul) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(i, j) += A(i, k) * B(k, j) where i in 0:1024, j in 0:30, k in 0:512
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // 3 square tiles of 4-byte elements in 32KiB, 1MiB and 32MiB, rounded
+  // down to 8 lanes and clamped to the extents.
+  std::string builder =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<1>, K<1>, "
+      "Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, "
+      "Tiles<\"{{48, 30, 48}, {288, 30, 288}, {1024, 30, 512}}\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldEmitCacheTilesForTypedMatMul) {
+
+  std::string raw = R"(
+  def GEMM(bfloat16 A, bfloat16 B, float C) {
+    what = how
+    C(i, j) += A(i, k) * B(k, j) where i in 0:1024, j in 0:30, k in 0:512
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // tiles of 2-byte inputs and a 4-byte output, rounded down to 16 lanes.
+  std::string builder =
+      "Tiles<\"{{64, 30, 64}, {352, 30, 352}, {1024, 30, 512}}\">, "
+      "Parallel<[\"i\",\"j\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldEmitCacheTilesForGroupedMatMul) {
+
+  std::string raw = R"(
+  def GEMM {
+    what = how
+    C(m, n, p) += A(m, k) * B(k, n, p)
+      where m in 0:64, n in 0:8, p in 0:16, k in 0:1024
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // N is the product of the extents of n and p.
+  std::string builder =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">, M<1>, N<2>, K<1>, "
+      "Constant<\"1\">, Constant<\"1\">, Inputs<[\"A\",\"B\"]>, "
+      "Outputs<[\"C\"]>, "
+      "Tiles<\"{{48, 48, 48}, {64, 128, 288}, {64, 128, 1024}}\">, "
+      "Parallel<[\"m\",\"n\",\"p\"]>, Reduction<[\"k\"]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldEmitCacheTilesForTranspose) {
+
+  std::string raw = R"(
+  def TRANSPOSE {
+    what = how
+    B(k, i, j) = A(i, j, k) where i in 0:100, j in 0:1000, k in 0:1000
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder =
+      "transposeBuilder<Inputs<[\"A\"]>, Outputs<[\"B\"]>, "
+      "StrExpr<\"{2,0,1}\">, "
+      "Tiles<\"{{64, 1, 64}, {360, 1, 360}, {1000, 1, 1000}}\">, "
+      "Parallel<[\"k\",\"i\",\"j\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder) != std::string::npos);
+}
+
+TEST(DslTest, shouldAnnotateContractionStepsWithTheirOwnLoops) {
+
+  std::string raw = R"(
+  def CHAIN {
+    what = how
+    D(i, l) += A(i, j) * B(j, k) * C(k, l)
+      where i in 0:10, j in 0:1000, k in 0:1000, l in 0:10
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // each binary contraction reduces its own index, not the ones of
+  // the statement.
+  std::string builder1 =
+      "Inputs<[\"A\",\"B\"]>, Outputs<[\"tmp0\"]>, Parallel<[\"i\",\"k\"]>, "
+      "Reduction<[\"j\"]>>,";
+  std::string builder2 =
+      "Inputs<[\"tmp0\",\"C\"]>, Outputs<[\"D\"]>, Parallel<[\"i\",\"l\"]>, "
+      "Reduction<[\"k\"]>>,";
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(builder1Pos < builder2Pos);
+}
+
+TEST(DslTest, shouldChooseTemporaryLayoutWithoutTranspose) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a,c,b) += A(a,c,d) * B(d,b)
+      where a in 0:64, c in 0:32, b in 0:128, d in 0:256
+    how
+    E(d,f) = A(a,c,d) where f = a * c
+    D(f,b) += E(d,f) * B(d,b)
+    C(a,c,b) = D(f,b) where f = a * c
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // storing E as (f,d) turns the reshape of A into a view and the matmul
+  // reads E without transposing it.
+  std::string builder1 =
+      "reshapeViewBuilder<Inputs<[\"A\"]>, Outputs<[\"E\"]>, "
+      "StrExpr<\"{{0, 1}, 2}\">, Parallel<[\"f\",\"d\"]>, Reduction<[]>>,";
+  std::string builder2 = "matmulBuilder<StrExpr<\"N\">, StrExpr<\"N\">,";
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+  ASSERT_TRUE(res.find("transposeBuilder") == std::string::npos);
+}
+
+TEST(DslTest, shouldRegroupManyDimensionsInOneReshape) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a, b, c, d, e, f) += A(a, b, c, d, e, f) * B(a, b, c, d, e, f)
+    how
+    T(i, j, k) = A(a, b, c, d, e, f) where i = a * b, j = c * d, k = e * f
+    U(i, j, k) = B(a, b, c, d, e, f) where i = a * b, j = c * d, k = e * f
+    V(i, j, k) = T(i, j, k) * U(i, j, k)
+    C(a, b, c, d, e, f) = V(i, j, k) where i = a * b, j = c * d, k = e * f
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder1 =
+      "reshapeViewBuilder<Inputs<[\"A\"]>, Outputs<[\"T\"]>, "
+      "StrExpr<\"{{0, 1}, {2, 3}, {4, 5}}\">, "
+      "Parallel<[\"i\",\"j\",\"k\"]>, Reduction<[]>>,";
+  std::string builder2 =
+      "reshapeBuilder<Inputs<[\"V\"]>, Outputs<[\"C\"]>, "
+      "StrExpr<\"{{0, 1}, {2, 3}, {4, 5}}\">, "
+      "Parallel<[\"a\",\"b\",\"c\",\"d\",\"e\",\"f\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+}
+
+TEST(DslTest, shouldRejectReshapeWithoutLet) {
+
+  std::string raw = R"(
+  def RESHAPE {
+    what = how
+    T(a, b) = A(a) where a in 0:4
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  EXPECT_THROW(emitTactic(p, S), ErrorReport);
+}
+
+TEST(DslTest, shouldPermuteAndRegroupManyDimensionsInOneBuilder) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a, b, c, d) += A(a, e, b, f) * B(e, f, c, d)
+    how
+    E(i, k) = A(a, e, b, f) where i = a * b, k = e * f
+    F(k, j) = B(e, f, c, d) where k = e * f, j = c * d
+    D(j, i) += F(k, j) * E(i, k)
+    C(a, b, c, d) = D(j, i) where i = a * b, j = c * d
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string builder1 =
+      "permuteReshapeBuilder<Inputs<[\"A\"]>, Outputs<[\"E\"]>, "
+      "StrExpr<\"{0,2,1,3}\">, StrExpr<\"{{0, 1}, {2, 3}}\">, "
+      "Parallel<[\"a\",\"b\",\"e\",\"f\"]>, Reduction<[]>>,";
+  std::string builder2 =
+      "permuteReshapeBuilder<Inputs<[\"D\"]>, Outputs<[\"C\"]>, "
+      "StrExpr<\"{2,3,0,1}\">, StrExpr<\"{{0, 1}, {2, 3}}\">, "
+      "Parallel<[\"a\",\"b\",\"c\",\"d\"]>, Reduction<[]>>,";
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+  ASSERT_TRUE(res.find("tmp") == std::string::npos);
+}
+
+TEST(DslTest, shouldWriteMatMulResultInPlace) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a, b, c) += A(a, d, b) * B(d, c)
+    how
+    D(f, c) = C(a, b, c) where f = a * b
+    E(f, d) = A(a, d, b) where f = a * b
+    D(f, c) += E(f, d) * B(d, c)
+    C(a, b, c) = D(f, c) where f = a * b
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // D is a view of C, the matmul updates C and the final reshape is
+  // dropped.
+  std::string builder1 =
+      "reshapeViewBuilder<Inputs<[\"C\"]>, Outputs<[\"D\"]>, "
+      "StrExpr<\"{{0, 1}, 2}\">, Parallel<[\"f\",\"c\"]>, Reduction<[]>>,";
+  std::string builder2 = "Inputs<[\"E\",\"B\"]>, Outputs<[\"D\"]>,";
+  ASSERT_TRUE(res.find(builder1) != std::string::npos);
+  ASSERT_TRUE(res.find(builder2) != std::string::npos);
+  ASSERT_TRUE(res.find("Outputs<[\"C\"]>") == std::string::npos);
+}
+
+TEST(DslTest, shouldDispatchOnShapeGuards) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a, b, c) += A(a, c, d) * B(d, b)
+    how when a * c < 256 && b == 1
+    D(a, c, b) = C(a, b, c)
+    E(f, b) = D(a, c, b) where f = a * c
+    F(f, d) = A(a, c, d) where f = a * c
+    E(f, b) += F(f, d) * B(d, b)
+    C(a, b, c) = E(f, b) where f = a * c
+    how
+    D(f, b) = C(a, b, c) where f = a * c
+    E(f, d) = A(a, c, d) where f = a * c
+    D(f, b) += E(f, d) * B(d, b)
+    C(a, b, c) = D(f, b) where f = a * c
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string version1 =
+      "dispatchBuilder<Guard<\"a * c < 256 && b == 1\">, [\n"
+      "    transposeBuilder<Inputs<[\"C\"]>, Outputs<[\"D\"]>, ";
+  std::string version2 =
+      "dispatchBuilder<Guard<\"true\">, [\n"
+      "    permuteReshapeBuilder<Inputs<[\"C\"]>, Outputs<[\"D\"]>, ";
+  auto version1Pos = res.find(version1);
+  auto version2Pos = res.find(version2);
+  ASSERT_TRUE(version1Pos != std::string::npos);
+  ASSERT_TRUE(version2Pos != std::string::npos);
+  ASSERT_TRUE(version1Pos < version2Pos);
+}
+
+TEST(DslTest, shouldLowerEachVersionFromItsOwnHow) {
+
+  std::string raw = R"(
+  def GEMM {
+    what
+    C(m, n) += A(m, k) * B(k, n)
+    how when n == 1
+    y(f) = C(m, n) where f = m * n
+    x(g) = B(k, n) where g = k * n
+    y(f) += A(f, g) * x(g)
+    C(m, n) = y(f) where f = m * n
+    how
+    D(n, m) = C(m, n)
+    E(n, k) = B(k, n)
+    D(n, m) += E(n, k) * A(m, k)
+    C(m, n) = D(n, m)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  std::string version1 = "dispatchBuilder<Guard<\"n == 1\">, [\n";
+  std::string version2 = "dispatchBuilder<Guard<\"true\">, [\n";
+  std::string builder1 = "matvecBuilder<StrExpr<\"N\">, "
+                         "Inputs<[\"A\",\"x\"]>, Outputs<[\"y\"]>, ";
+  std::string builder2 =
+      "matmulBuilder<StrExpr<\"N\">, StrExpr<\"T\">, M<1>, N<1>, "
+      "K<1>, Constant<\"1\">, Constant<\"1\">, Inputs<[\"E\",\"A\"]>, "
+      "Outputs<[\"D\"]>, ";
+
+  auto version1Pos = res.find(version1);
+  auto version2Pos = res.find(version2);
+  auto builder1Pos = res.find(builder1);
+  auto builder2Pos = res.find(builder2);
+
+  ASSERT_TRUE(version1Pos != std::string::npos);
+  ASSERT_TRUE(version2Pos != std::string::npos);
+  ASSERT_TRUE(builder1Pos != std::string::npos);
+  ASSERT_TRUE(builder2Pos != std::string::npos);
+  ASSERT_TRUE(version1Pos < builder1Pos && builder1Pos < version2Pos);
+  ASSERT_TRUE(version2Pos < builder2Pos);
+}
+
+TEST(DslTest, shouldSelectVersionWithStaticShapes) {
+
+  std::string raw = R"(
+  def TTGT {
+    what
+    C(a, b, c) += A(a, c, d) * B(d, b)
+      where a in 0:8, b in 0:1, c in 0:8, d in 0:32
+    how when a * c < 256 && b == 1
+    D(a, c, b) = C(a, b, c)
+    E(f, b) = D(a, c, b) where f = a * c
+    F(f, d) = A(a, c, d) where f = a * c
+    E(f, b) += F(f, d) * B(d, b)
+    C(a, b, c) = E(f, b) where f = a * c
+    how
+    D(f, b) = C(a, b, c) where f = a * c
+    E(f, d) = A(a, c, d) where f = a * c
+    D(f, b) += E(f, d) * B(d, b)
+    C(a, b, c) = D(f, b) where f = a * c
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  // the guard holds for the extents of the what, no dispatch is needed.
+  ASSERT_TRUE(res.find("dispatchBuilder") == std::string::npos);
+  ASSERT_TRUE(res.find("transposeBuilder<Inputs<[\"C\"]>, "
+                       "Outputs<[\"D\"]>") != std::string::npos);
+}
+
+TEST(DslTest, shouldEvaluateUnaryMinusInGuards) {
+
+  std::string raw = R"(
+  def GEMM {
+    what
+    C(m, n) += A(m, k) * B(k, n)
+      where m in 0:4, n in 0:4, k in 0:4
+    how when -n < 0
+    C(m, n) += A(m, k) * B(k, n)
+    how
+    D(n, m) = C(m, n)
+    D(n, m) += B(k, n) * A(m, k)
+    C(m, n) = D(n, m)
+  }
+  )";
+  Parser p = Parser(raw);
+
+  std::string res;
+  raw_string_ostream S{res};
+  emitTactic(p, S);
+  S.str();
+
+  ASSERT_TRUE(res.find("dispatchBuilder") == std::string::npos);
+  ASSERT_TRUE(res.find("transposeBuilder") == std::string::npos);
+  ASSERT_TRUE(res.find("Outputs<[\"C\"]>") != std::string::npos);
 }